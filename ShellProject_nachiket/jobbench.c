@@ -0,0 +1,143 @@
+/* 
+ * jobbench.c - Measures the cost of the tsh job list helpers
+ * 
+ * usage: jobbench
+ * Links against tsh.c (with its main renamed) and, for job tables of
+ * 16, 1k and 64k entries, times lookups by pid and jid, fgpid, and an
+ * add/delete pair, printing nanoseconds per call. Before that it fills
+ * the table with 10k jobs, first all with the same command line and
+ * then with distinct ones, and reports the heap used (the second
+ * figure is on top of the first) and the time for a full scan of the
+ * table (maxjid).
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/types.h>
+
+#define LOOKUPS 4000000
+#define CHURN     10000
+#define SCANJOBS  10000
+#define SCANS      1000
+#define BG 2
+
+struct job_t;
+extern struct job_t *jobs;
+void initjobs(struct job_t *jobs);
+int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
+int deletejob(struct job_t *jobs, pid_t pid);
+pid_t fgpid(struct job_t *jobs);
+struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct job_t *jobs, int jid);
+int pid2jid(pid_t pid);
+int maxjid(struct job_t *jobs);
+
+static double now(void);
+static pid_t jobpid(int i);
+
+/* Bytes in use from malloc, including mmap'd blocks */
+static size_t heapused(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.uordblks + mi.hblkhd;
+}
+
+/* Heap used by 10k jobs, and the cost of one pass over the table */
+static void scanbench(char *label, int distinct)
+{
+    volatile long sink = 0;
+    char cmdline[64];
+    size_t before;
+    double t;
+    int i;
+
+    initjobs(jobs);
+    before = heapused();
+    for (i = 0; i < SCANJOBS; i++) {
+	sprintf(cmdline, "./myspin %d &\n", distinct ? i : 1);
+	addjob(jobs, jobpid(i), BG, cmdline);
+    }
+    t = now();
+    for (i = 0; i < SCANS; i++)
+	sink += maxjid(jobs);
+    printf("%-22s %10.1f KiB %10.1f us/scan\n", label,
+	   (heapused() - before) / 1024.0, (now() - t) * 1e6 / SCANS);
+    for (i = 0; i < SCANJOBS; i++)
+	deletejob(jobs, jobpid(i));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fake but distinct pids, spread out the way real ones are */
+static pid_t jobpid(int i)
+{
+    return 1000 + 7 * i;
+}
+
+int main(void) 
+{
+    static const int sizes[] = { 16, 1024, 65536 };
+    volatile long sink = 0;
+    unsigned int r = 1;
+    double t, pid_ns, jid_ns, fg_ns, churn_ns;
+    int i, k, n;
+
+    /* first, while the table has not grown yet */
+    printf("10k jobs\n");
+    scanbench("one cmdline", 0);
+    scanbench("distinct cmdlines (+)", 1);
+    printf("\n");
+
+    printf("%8s %12s %12s %12s %12s\n",
+	   "jobs", "getjobpid", "getjobjid", "fgpid", "add+delete");
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+	n = sizes[k];
+	initjobs(jobs);
+	for (i = 0; i < n; i++)
+	    if (!addjob(jobs, jobpid(i), BG, "./myspin 1 &\n")) {
+		fprintf(stderr, "addjob failed at %d jobs\n", i);
+		exit(1);
+	    }
+
+	t = now();
+	for (i = 0; i < LOOKUPS; i++) {
+	    r = r * 1103515245 + 12345;
+	    sink += getjobpid(jobs, jobpid(r % n)) != NULL;
+	}
+	pid_ns = (now() - t) * 1e9 / LOOKUPS;
+
+	t = now();
+	for (i = 0; i < LOOKUPS; i++) {
+	    r = r * 1103515245 + 12345;
+	    sink += getjobjid(jobs, 1 + r % n) != NULL;
+	}
+	jid_ns = (now() - t) * 1e9 / LOOKUPS;
+
+	t = now();
+	for (i = 0; i < LOOKUPS; i++)
+	    sink += fgpid(jobs);
+	fg_ns = (now() - t) * 1e9 / LOOKUPS;
+
+	t = now();
+	for (i = 0; i < CHURN; i++) {
+	    r = r * 1103515245 + 12345;
+	    deletejob(jobs, jobpid(r % n));
+	    addjob(jobs, jobpid(r % n), BG, "./myspin 1 &\n");
+	}
+	churn_ns = (now() - t) * 1e9 / CHURN;
+
+	printf("%8d %12.1f %12.1f %12.1f %12.1f\n", n, pid_ns, jid_ns, fg_ns, churn_ns);
+	for (i = 0; i < n; i++)
+	    deletejob(jobs, jobpid(i));
+    }
+    exit(sink < 0);
+}
@@ -0,0 +1,235 @@
+/* 
+ * lexbench.c - Measures the throughput of the tsh command line lexer
+ * 
+ * usage: lexbench [trace files...]
+ * Builds a corpus from the shell commands in the given trace files
+ * (default trace*.txt in the current directory) plus a set of typical
+ * interactive command lines, and reports MB/s for lexline() with the
+ * scalar, SSE2 and AVX2 scanners, and for the original strchr-based
+ * parseline for comparison. The corpus is then rejoined into ~4 KB
+ * lines and measured again.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <time.h>
+
+#define CORPUS  (8 << 20)   /* bytes of command lines to lex per pass */
+#define PASSES  10
+#define MAXLINE 1024
+#define MAXARGS 128
+
+struct token_t { int type; int fd; char *text; };
+struct tokens_t { struct token_t *tok; int n; int cap; };
+extern int lexsimd;
+int lexline(char *buf, size_t len, struct tokens_t *toks);
+
+static const char *typical[] = {
+    "gcc -Wall -O2 -I/usr/include -DNDEBUG -o build/obj/parser.o -c src/parser.c\n",
+    "find . -name '*.c' -newer Makefile -print\n",
+    "grep -rn \"TODO: fix this\" src/ include/ --include='*.h'\n",
+    "tar czf \"backup 2024.tgz\" ./data ./config\\ files\n",
+    "ssh build@ci-runner-07 'cd /srv/app && make -j8 install' > deploy.log 2>&1 &\n",
+    "rsync -avz --delete --exclude='*.o' --exclude=.git ./src/ backup@nas:/volume1/src/\n",
+    "./myspin 5 &\n",
+    "jobs\n",
+    "/usr/bin/python3 -m pytest -x -q tests/test_scheduler.py::test_admission_queue\n",
+    "cat /var/log/syslog | grep -i \"error\" | sort | uniq -c | sort -rn | head -20\n",
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The original tsh parseline, kept here as the reference point */
+static int legacy_parseline(const char *cmdline, char **argv) 
+{
+    static char array[MAXLINE];
+    char *buf = array;
+    char *delim;
+    int argc, bg;
+
+    strcpy(buf, cmdline);
+    buf[strlen(buf)-1] = ' ';
+    while (*buf && (*buf == ' '))
+	buf++;
+    argc = 0;
+    if (*buf == '\'') {
+	buf++;
+	delim = strchr(buf, '\'');
+    }
+    else
+	delim = strchr(buf, ' ');
+    while (delim) {
+	argv[argc++] = buf;
+	*delim = '\0';
+	buf = delim + 1;
+	while (*buf && (*buf == ' '))
+	    buf++;
+	if (*buf == '\'') {
+	    buf++;
+	    delim = strchr(buf, '\'');
+	}
+	else
+	    delim = strchr(buf, ' ');
+    }
+    argv[argc] = NULL;
+    if (argc == 0)
+	return 1;
+    if ((bg = (*argv[argc-1] == '&')) != 0)
+	argv[--argc] = NULL;
+    return bg;
+}
+
+/* add - Append one line to the corpus if there is room */
+static size_t add(char *corpus, size_t used, const char *line)
+{
+    size_t len = strlen(line);
+
+    if (used + len > CORPUS)
+	return used;
+    memcpy(corpus + used, line, len);
+    return used + len;
+}
+
+/* Shell commands from the trace files: not comments, blank or driver lines */
+static size_t load_traces(int argc, char **argv, char *lines, size_t cap)
+{
+    glob_t g;
+    FILE *fp;
+    char line[MAXLINE];
+    size_t n = 0, len;
+    int i;
+
+    g.gl_pathc = 0;
+    if (argc < 2 && glob("trace*.txt", 0, NULL, &g) == 0) {
+	argc = g.gl_pathc + 1;
+	argv = g.gl_pathv - 1;
+    }
+    for (i = 1; i < argc; i++) {
+	if ((fp = fopen(argv[i], "r")) == NULL)
+	    continue;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+	    if (line[0] == '#' || line[0] == '\n' || strncmp(line, "SLEEP", 5) == 0 ||
+		strcmp(line, "TSTP\n") == 0 || strcmp(line, "INT\n") == 0 ||
+		strcmp(line, "QUIT\n") == 0 || strcmp(line, "CLOSE\n") == 0 ||
+		strcmp(line, "WAIT\n") == 0)
+		continue;
+	    len = strlen(line);
+	    if (n + len >= cap)
+		break;
+	    memcpy(lines + n, line, len);
+	    n += len;
+	}
+	fclose(fp);
+    }
+    if (g.gl_pathc > 0)
+	globfree(&g);
+    lines[n] = '\0';
+    return n;
+}
+
+/* run - Report MB/s for each lexer over the corpus */
+static void run(char *corpus, char *work, size_t used, struct tokens_t *toks)
+{
+    static const char *names[] = { "lexline scalar", "lexline SSE2", "lexline AVX2" };
+    char *p, *nl, *largv[MAXARGS];
+    size_t longest = 0;
+    double t, best;
+    int level, pass;
+
+    for (p = corpus; p < corpus + used; p = nl + 1) {
+	nl = memchr(p, '\n', corpus + used - p);
+	if (nl - p >= longest)
+	    longest = nl - p + 1;
+    }
+
+    for (level = 0; level < 3; level++) {
+	lexsimd = level;
+	best = 1e9;
+	for (pass = 0; pass < PASSES; pass++) {
+	    memcpy(work, corpus, used + 1);   /* lexline writes into its input */
+	    t = now();
+	    for (p = work; p < work + used; p = nl + 1) {
+		nl = memchr(p, '\n', work + used - p);
+		lexline(p, nl + 1 - p, toks);
+	    }
+	    if ((t = now() - t) < best)
+		best = t;
+	}
+	printf("%-20s %8.1f MB/s\n", names[level], used / best / 1e6);
+    }
+
+    if (longest >= MAXLINE) {
+	printf("%-20s %13s\n", "legacy parseline", "(too long)");
+	return;
+    }
+    best = 1e9;
+    for (pass = 0; pass < PASSES; pass++) {
+	memcpy(work, corpus, used + 1);
+	t = now();
+	for (p = work; p < work + used; p = nl + 1) {
+	    nl = strchr(p, '\n');
+	    *nl = '\0';                      /* legacy_parseline copies the line */
+	    legacy_parseline(p, largv);
+	}
+	if ((t = now() - t) < best)
+	    best = t;
+    }
+    printf("%-20s %8.1f MB/s\n", "legacy parseline", used / best / 1e6);
+}
+
+int main(int argc, char **argv) 
+{
+    static char traces[64 << 10];
+    struct tokens_t toks = { NULL, 0, 0 };
+    char *corpus, *work, *p, *nl;
+    size_t used = 0, ntraces;
+    int i, nlines = 0;
+
+    if ((corpus = malloc(CORPUS + 64)) == NULL || (work = malloc(CORPUS + 64)) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    ntraces = load_traces(argc, argv, traces, sizeof(traces));
+    while (used < CORPUS - MAXLINE) {
+	for (p = traces; p < traces + ntraces; p = nl + 1) {
+	    nl = strchr(p, '\n');
+	    *nl = '\0';
+	    used = add(corpus, used, p);
+	    used = add(corpus, used, "\n");
+	    *nl = '\n';
+	}
+	for (i = 0; i < sizeof(typical) / sizeof(typical[0]); i++)
+	    used = add(corpus, used, typical[i]);
+    }
+    corpus[used] = '\0';
+    for (p = corpus; p < corpus + used; p++)
+	nlines += (*p == '\n');
+    printf("corpus: %.1f MB, %d lines\n", used / 1e6, nlines);
+
+    run(corpus, work, used, &toks);
+
+    /* the same lines joined into ~4 KB ones, like a long xargs command */
+    for (p = corpus, i = 0; p < corpus + used; p++, i++) {
+	if (*p != '\n')
+	    continue;
+	if (i < 4096)
+	    *p = ' ';
+	else
+	    i = 0;
+    }
+    corpus[used - 1] = '\n';
+    for (p = corpus, nlines = 0; p < corpus + used; p++)
+	nlines += (*p == '\n');
+    printf("\nsame corpus as %d lines of ~4 KB\n", nlines);
+    run(corpus, work, used, &toks);
+    exit(0);
+
+}
@@ -0,0 +1,183 @@
+/*
+ * mkbuiltins.c - Generates the tsh builtin registry
+ *
+ * usage: mkbuiltins < builtins.def > builtins.h
+ * Reads the builtin table (name, handler, min and max argument count,
+ * flags; '#' starts a comment) and writes it out as a perfect hash
+ * table in the style of gperf: a name hashes to its length plus the
+ * bi_asso[] values of the characters at the bi_keypos[] positions
+ * (-1 being the last character, and a position past the end counting
+ * as character 0), masked to BI_SLOTS. The key positions, the table
+ * size and the bi_asso[] values are searched for here, so tsh needs a
+ * single probe and one strcmp to look a name up. The search is seeded,
+ * so the same table always gives the same output.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXBUILTINS 64
+#define MAXNAME     32
+#define MAXKEYPOS    8
+#define MAXSLOTS  1024
+#define TRIES    20000   /* random bi_asso[] tables tried per table size */
+
+struct entry {
+    char name[MAXNAME];
+    char handler[64];
+    int minargs;
+    int maxargs;
+    char flags[128];
+};
+
+static struct entry ent[MAXBUILTINS];
+static int nent;
+static int keypos[MAXKEYPOS], nkeypos;
+static unsigned int asso[256];
+static unsigned long seed = 1;
+
+/* rnd - A small LCG, so the output does not depend on the C library */
+static unsigned int rnd(void)
+{
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return seed >> 33;
+}
+
+/* keychar - The character of s that key position k stands for */
+static unsigned char keychar(const char *s, int k)
+{
+    size_t len = strlen(s);
+
+    if (k < 0)
+	return s[len - 1];
+    return (k < len) ? s[k] : 0;
+}
+
+/* hash - The hash tsh computes, for nslots slots */
+static unsigned int hash(const char *s, unsigned int nslots)
+{
+    unsigned int h = strlen(s);
+    int i;
+
+    for (i = 0; i < nkeypos; i++)
+	h += asso[keychar(s, keypos[i])];
+    return h & (nslots - 1);
+}
+
+/* distinct_keys - True if no two names agree in length and key characters */
+static int distinct_keys(void)
+{
+    int i, j, k;
+
+    for (i = 0; i < nent; i++)
+	for (j = i + 1; j < nent; j++) {
+	    if (strlen(ent[i].name) != strlen(ent[j].name))
+		continue;
+	    for (k = 0; k < nkeypos; k++)
+		if (keychar(ent[i].name, keypos[k]) != keychar(ent[j].name, keypos[k]))
+		    break;
+	    if (k == nkeypos)
+		return 0;
+	}
+    return 1;
+}
+
+/* try_slots - Look for bi_asso[] values that make the hash perfect */
+static int try_slots(unsigned int nslots)
+{
+    char used[MAXSLOTS];
+    unsigned int h;
+    int t, i, k;
+
+    for (t = 0; t < TRIES; t++) {
+	memset(asso, 0, sizeof(asso));
+	for (i = 0; i < nent; i++)
+	    for (k = 0; k < nkeypos; k++)
+		asso[keychar(ent[i].name, keypos[k])] = rnd() % nslots;
+	memset(used, 0, nslots);
+	for (i = 0; i < nent; i++) {
+	    if (used[h = hash(ent[i].name, nslots)])
+		break;
+	    used[h] = 1;
+	}
+	if (i == nent)
+	    return 1;
+    }
+    return 0;
+}
+
+/* load - Read builtins.def from stdin */
+static void load(void)
+{
+    char line[256], *p;
+    struct entry *e;
+    int n;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+	if ((p = strchr(line, '#')) != NULL)
+	    *p = '\0';
+	if (strspn(line, " \t\n") == strlen(line))
+	    continue;
+	if (nent == MAXBUILTINS) {
+	    fprintf(stderr, "mkbuiltins: more than %d builtins\n", MAXBUILTINS);
+	    exit(1);
+	}
+	e = &ent[nent];
+	n = sscanf(line, "%31s %63s %d %d %127s", e->name, e->handler,
+		   &e->minargs, &e->maxargs, e->flags);
+	if (n < 4) {
+	    fprintf(stderr, "mkbuiltins: bad line: %s", line);
+	    exit(1);
+	}
+	if (n == 4)
+	    strcpy(e->flags, "0");
+	nent++;
+    }
+}
+
+int main(void)
+{
+    unsigned int nslots;
+    int i, k, maxlen = 0;
+
+    load();
+    for (i = 0; i < nent; i++)
+	if (strlen(ent[i].name) > maxlen)
+	    maxlen = strlen(ent[i].name);
+
+    /* first and last character, then add the second, the third, ... */
+    for (nkeypos = 2; nkeypos <= MAXKEYPOS; nkeypos++) {
+	keypos[0] = -1;
+	for (k = 1; k < nkeypos; k++)
+	    keypos[k] = k - 1;
+	if (nkeypos - 1 > maxlen || !distinct_keys())
+	    continue;
+	for (nslots = 1; nslots < 2 * nent; nslots *= 2)
+	    ;
+	for (; nslots <= MAXSLOTS; nslots *= 2)
+	    if (try_slots(nslots))
+		goto found;
+    }
+    fprintf(stderr, "mkbuiltins: no perfect hash found\n");
+    exit(1);
+
+found:
+    printf("/* builtins.h - Generated from builtins.def by mkbuiltins. Do not edit. */\n\n");
+    printf("#define BI_SLOTS %u\n", nslots);
+    printf("#define BI_NKEYPOS %d\n\n", nkeypos);
+    printf("static const int bi_keypos[BI_NKEYPOS] = {");
+    for (k = 0; k < nkeypos; k++)
+	printf("%s%d", k ? ", " : " ", keypos[k]);
+    printf(" };\n\n");
+    printf("static const unsigned short bi_asso[256] = {\n");
+    for (i = 0; i < 256; i++)
+	printf("%s%u,%s", (i % 16) ? " " : "  ", asso[i], (i % 16 == 15) ? "\n" : "");
+    printf("};\n\n");
+    printf("static const struct builtin_t builtins[BI_SLOTS] = {\n");
+    for (i = 0; i < nent; i++)
+	printf("  [%u] = { \"%s\", %s, %d, %d, %s },\n", hash(ent[i].name, nslots),
+	       ent[i].name, ent[i].handler, ent[i].minargs, ent[i].maxargs, ent[i].flags);
+    printf("};\n");
+    exit(0);
+}
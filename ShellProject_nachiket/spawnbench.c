@@ -0,0 +1,118 @@
+/* 
+ * spawnbench.c - Measures how fast the two tsh spawn backends can
+ * start and reap short-lived jobs as the shell's memory footprint grows.
+ * 
+ * usage: spawnbench [n] [prog]
+ * For each resident size it dirties that many MiB of heap (standing in
+ * for a large shell) and then starts <n> copies of <prog> (default
+ * "./myspin 0") with fork+execve and with posix_spawn, printing the
+ * spawns per second achieved by each.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void reap(pid_t pid)
+{
+    int status;
+
+    if (waitpid(pid, &status, 0) < 0) {
+	perror("waitpid");
+	exit(1);
+    }
+}
+
+static double run_fork(int n, char **argv)
+{
+    int i;
+    pid_t pid;
+    double start = now();
+
+    for (i = 0; i < n; i++) {
+	if ((pid = fork()) < 0) {
+	    perror("fork");
+	    exit(1);
+	}
+	if (pid == 0) {
+	    setpgid(0, 0);
+	    execve(argv[0], argv, environ);
+	    _exit(127);
+	}
+	reap(pid);
+    }
+    return n / (now() - start);
+}
+
+static double run_spawn(int n, char **argv)
+{
+    int i;
+    pid_t pid;
+    posix_spawnattr_t attr;
+    double start = now();
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+    for (i = 0; i < n; i++) {
+	if (posix_spawn(&pid, argv[0], NULL, &attr, argv, environ) != 0) {
+	    perror("posix_spawn");
+	    exit(1);
+	}
+	reap(pid);
+    }
+    posix_spawnattr_destroy(&attr);
+    return n / (now() - start);
+}
+
+int main(int argc, char **argv) 
+{
+    static const int sizes[] = { 0, 64, 256, 1024 };  /* MiB */
+    char *dflt[] = { "./myspin", "0", NULL };
+    char **prog = dflt;
+    char *heap = NULL;
+    size_t have = 0, want;
+    int i, n = 500;
+
+    if (argc > 1)
+	n = atoi(argv[1]);
+    if (argc > 2)
+	prog = &argv[2];
+    if (n <= 0) {
+	fprintf(stderr, "Usage: %s [n] [prog [args...]]\n", argv[0]);
+	exit(1);
+    }
+
+    printf("%8s %14s %14s\n", "RSS MiB", "fork/s", "posix_spawn/s");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+	want = (size_t)sizes[i] << 20;
+	if (want > have) {
+	    if ((heap = realloc(heap, want)) == NULL) {
+		perror("realloc");
+		exit(1);
+	    }
+	    memset(heap + have, 1, want - have);  /* make it resident */
+	    have = want;
+	}
+	printf("%8d %14.0f", sizes[i], run_fork(n, prog));
+	printf(" %14.0f\n", run_spawn(n, prog));
+	fflush(stdout);
+    }
+    free(heap);
+    exit(0);
+}
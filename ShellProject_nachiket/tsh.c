@@ -3,6 +3,7 @@
     Name : Nachiket Trivedi
     ID   : 201401047
  */
+#define _GNU_SOURCE          /* O_PATH and other Linux extensions */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -12,18 +13,106 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/file.h>
+#include <dirent.h>
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
-#define MAXJID    1<<16   /* max job ID */
+#define MAXJOBS (1<<16)   /* max jobs at any point in time */
+#define INITJOBS     16   /* initial size of the job table */
+#define MAXJID  (1<<16)   /* max job ID */
+#define CMDHASH     256   /* buckets in the command hash table */
+#define CMDARENA_MIN 65536 /* initial size of the command line arena */
+#define CMDARENA_START  16 /* first handle; 0 means no command line */
+#define PIPEBIG  (1<<20)  /* pipe size for stages that write a lot */
+#define LEXPAD       64   /* readable bytes lexline needs past the end of a line */
+#define OUTBUF     8192   /* size of the shell's output buffer */
+#define LISTBATCH   256   /* jobs listed per writev call */
+#define SIONOTE      96   /* longest "Job [..] (..) ... by signal .." line */
+#define SIGCHLDBUF 4096   /* job notices sigchld_handler writes at once */
+#define DONERING     16   /* finished jobs kept for jobs -l */
+#define PARCOPY   65536   /* bytes of -k task output parallel copies at a time */
+#define PARFAILMAX  101   /* parallel exits with the number of failed tasks, up to this */
+#define ZYGOTEBUF 65536   /* largest request to the zygote; bigger ones are started directly */
+#define HISTBYTES (64<<20) /* size of the ring in a new history file */
+#define HISTHDR    4096   /* bytes before the ring, for the header */
+#define HISTMAXLINE 65536 /* longer lines are not kept in the history */
+#define HISTSYNC     32   /* lines added to the history between msyncs */
+#define HISTPENDMAX  64   /* lines kept back while another shell adds to the history */
+#define HISTGRAMS 65536   /* buckets of the history trigram index, a power of two */
+#define HISTRECENT 4096   /* entries ! recall checks newest first before the index */
+#define HISTPAD 0xffffffffu /* record length meaning the rest of the ring is unused */
+#define HISTMAGIC "tshhist1" /* first 8 bytes of a history file */
+#define TRIE_PATH     1   /* trie node ends the name of an executable on PATH */
+#define TRIE_BUILTIN  2   /* trie node ends the name of a builtin */
 
 /* Job states */
+/* Builtin flags (builtins.def) */
+#define BI_JOBS 1 /* uses the job table: job control signals wait while it runs */
+#define BI_UTIL 2 /* a standard utility: also runs for /bin/<name> and /usr/bin/<name> */
+#define BI_FORK 4 /* runs like a program, in a child of the shell: a job or a pipeline stage */
+#define BI_EXTERNAL -1 /* returned by a BI_UTIL handler: run the program instead */
+
 #define UNDEF 0 /* undefined */
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
+#define QU 4    /* queued, waiting to be admitted */
+
+/* CPU placement policies (affinity builtin) */
+#define AFF_NONE    0  /* where the kernel puts them */
+#define AFF_PIN     1  /* every process on aff_cpus */
+#define AFF_SPREAD  2  /* each process on the next CPU of aff_cpus, round-robin */
+#define AFF_ISOLATE 3  /* every process on any CPU but aff_cpus */
+
+/* What a place_t sets, or-ed together */
+#define PL_CPUS  1  /* the CPU affinity mask */
+#define PL_NICE  2  /* the nice value */
+#define PL_SCHED 4  /* the scheduling policy */
+#define PL_IO    8  /* the I/O priority */
+
+/* I/O priorities, as in linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+#define IOPRIO_WHO_PROCESS 1
+
+/* Descriptors passed with a zygote request */
+#define ZFD_IN  1  /* standard input */
+#define ZFD_OUT 2  /* standard output */
+#define ZFD_EXE 4  /* the hashed executable, for fexecve */
+
+/* Admission priority classes, highest first */
+#define NQCLASS 3
+
+/* Token types produced by lexline */
+#define TOK_WORD   0  /* a word, with quotes and escapes removed */
+#define TOK_BG     1  /* & */
+#define TOK_PIPE   2  /* | */
+#define TOK_SEMI   3  /* ; */
+#define TOK_IN     4  /* [n]< */
+#define TOK_OUT    5  /* [n]> */
+#define TOK_APPEND 6  /* [n]>> */
+#define TOK_DUPOUT 7  /* [n]>& */
 
 /* 
  * Jobs states: FG (foreground), BG (background), ST (stopped)
@@ -39,16 +128,230 @@
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
-int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
+int event_loop = 0;         /* if true, take signals and input through epoll */
+int sigfd = -1;             /* signalfd for SIGCHLD, SIGINT and SIGTSTP */
+int epfd = -1;              /* epoll instance watching stdin and sigfd */
+int stdin_pollable = 1;     /* false if stdin is a regular file */
+int use_fork = 0;           /* if true, spawn jobs with fork+execve */
+int use_zygote = 0;         /* if true, start a zygote to spawn jobs */
+int zygote_fd = -1;         /* the shell's end of the zygote's socket, or -1 */
+const char *script_name = NULL; /* script being run by -f or source, if any */
+char outbuf[OUTBUF];        /* shell output not yet written to fd 1 */
+size_t outlen = 0;          /* bytes used in outbuf */
+volatile sig_atomic_t out_busy = 0; /* set while the main program changes outbuf */
+int script_line = 0;        /* line of script_name being run */
 
+struct usage_t {            /* Resources used by a job's processes */
+  uint64_t utime;         /* user CPU time, microseconds */
+  uint64_t stime;         /* system CPU time, microseconds */
+  long maxrss;            /* peak resident set of any one process, KB */
+  long minflt;            /* page faults served without I/O */
+  long majflt;            /* page faults that needed I/O */
+  long nvcsw;             /* voluntary context switches */
+  long nivcsw;            /* involuntary context switches */
+};
+struct proc_t {             /* One stage of a pipeline */
+  pid_t pid;              /* stage PID */
+  int status;             /* wait status once reaped, -1 until then */
+};
 struct job_t {              /* The job struct */
-  pid_t pid;              /* job PID */
+  pid_t pid;              /* job PID, and the process group of every stage */
   int jid;                /* job ID [1, 2, ...] */
   int state;              /* UNDEF, BG, FG, or ST */
-  char cmdline[MAXLINE];  /* command line */
+  uint32_t cmd;           /* command line, a handle into cmdarena */
+  int nprocs;             /* stages in the pipeline, 1 for a simple command */
+  int nlive;              /* stages not reaped yet */
+  struct proc_t *procs;   /* the stages if nprocs > 1, else NULL */
+  int pidfd;              /* pidfd of the job PID, or -1 */
+  struct usage_t usage;   /* of the processes reaped so far */
+  int qclass;             /* admission class while QU */
+  int qprev, qnext;       /* neighbours in its class's queue, slot+1, 0 if none */
+  int penalty;            /* nice levels added by sched -b while out of the foreground */
+};
+struct job_t *jobs = NULL;  /* The job list, grown on demand */
+int maxjobs = 0;            /* number of slots allocated in jobs */
+int jobs_hwm = 0;           /* one past the highest slot in use */
+int fgslot = -1;            /* slot of the foreground job, or -1 */
+struct pident_t {           /* An entry of the pid index */
+  pid_t pid;              /* a job PID or a stage PID, 0 if the entry is free */
+  int slot;               /* slot of the job it belongs to */
+};
+struct pident_t *pidindex = NULL; /* open-addressed pid -> slot index */
+unsigned int pidcap = 0;    /* size of pidindex, a power of two */
+int jidindex[MAXJID+1];     /* jid -> slot+1, 0 if the jid is free */
+int nbg = 0;                /* jobs in state BG */
+
+int admit_max = 0;          /* most BG jobs at once before new ones queue, 0 for no limit */
+double admit_rate = 0;      /* background starts per second, 0 for no limit */
+int admit_burst = 1;        /* starts the token bucket can save up */
+double admit_tokens = 0;    /* starts that may happen now */
+struct timespec admit_last; /* when admit_tokens was last topped up */
+int admit_class = 1;        /* class new jobs are queued in */
+int qhead[NQCLASS];         /* oldest queued job of each class, slot+1, 0 if none */
+int qtail[NQCLASS];         /* newest queued job of each class, slot+1, 0 if none */
+int nqueued = 0;            /* jobs in state QU */
+const char *qclassname[NQCLASS] = { "high", "normal", "low" };
+
+int aff_policy = AFF_NONE;  /* AFF_*, the placement of processes with no @cpus= prefix */
+cpu_set_t aff_cpus;         /* the CPUs the policy was given */
+cpu_set_t aff_mask;         /* for AFF_PIN and AFF_ISOLATE, the mask processes get */
+int aff_next = 0;           /* CPU AFF_SPREAD tries next */
+
+struct place_t {            /* How a process is run: @ prefixes and the shell-wide policies */
+  int set;                /* PL_* fields that are given */
+  cpu_set_t cpus;         /* CPUs it may run on */
+  int nice;               /* its nice value */
+  int policy;             /* SCHED_OTHER, SCHED_BATCH or SCHED_IDLE */
+  int ioprio;             /* IOPRIO_PRIO_VALUE of its I/O class and level */
+};
+struct histhdr_t {          /* The header of the history file */
+  char magic[8];          /* HISTMAGIC */
+  uint64_t size;          /* bytes in the ring, which starts at HISTHDR */
+  uint64_t head, tail;    /* ring offsets of the next record and the oldest, before wrapping */
+  uint64_t seqhead;       /* number of the next line */
+  uint64_t seqtail;       /* number of the oldest line kept */
+};
+struct hline_t {            /* A distinct line in the history index */
+  uint64_t seq;           /* its latest entry */
+  uint32_t hash;          /* hist_hash of it */
+};
+struct posting_t {          /* The distinct lines with one hashed trigram */
+  uint32_t *ids;          /* their indexes in hlines, in the order first seen */
+  uint32_t n, cap;
+};
+struct histhdr_t *hist = NULL; /* the mapped history, NULL until first used */
+char *histdata;             /* its ring */
+int histfd = -1;            /* the history file, -1 if the ring is only in memory */
+char *histpend[HISTPENDMAX]; /* lines waiting for the file lock */
+int nhistpend = 0;
+int histunsynced = 0;       /* lines added since the last msync */
+uint64_t *histoff = NULL;   /* ring offset of each indexed entry, from histbase */
+size_t histoffcap = 0;
+uint64_t histbase = 0;      /* first entry in histoff */
+uint64_t histseen = 0;      /* next entry to index */
+uint64_t histpos = 0;       /* ring offset of entry histseen */
+struct hline_t *hlines = NULL; /* the distinct lines indexed */
+uint32_t nhlines = 0, hlinescap = 0;
+uint32_t *hltab = NULL;     /* open-addressed hash of hlines, index+1, 0 if empty */
+uint32_t hltabcap = 0;
+struct posting_t histgram[HISTGRAMS]; /* trigram index into hlines */
+
+struct zreq_t {             /* A request to the zygote: start a program */
+  pid_t pgid;             /* process group to put it in, 0 for a new one */
+  int nargv;              /* words in its argv */
+  int nredir;             /* redirections, as type and fd pairs after this */
+  int fds;                /* ZFD_* descriptors that come with it, in that order */
+  struct place_t pl;      /* how it is placed */
+};                          /* then the path, argv and redirection targets, NUL terminated */
+int sched_nice = 0;         /* nice increment of new processes, from the shell's value */
+int sched_policy = -1;      /* scheduling policy of new processes, -1 for the shell's */
+int sched_ioprio = -1;      /* I/O priority of new processes, -1 for the shell's */
+int sched_boost = 0;        /* nice levels a job loses while out of the foreground */
+const char *policyname[] = { "other", "fifo", "rr", "batch", "-", "idle", "deadline" };
+const char *ioclassname[] = { "none", "rt", "be", "idle" };
+
+struct done_t {             /* A finished job, kept for jobs -l */
+  pid_t pid;              /* its job PID */
+  int jid;                /* its job ID */
+  int status;             /* wait status it ended with */
+  uint32_t cmd;           /* command line handle, passed on from the job */
+  struct usage_t usage;   /* everything its processes used */
+};
+struct done_t donering[DONERING]; /* the last DONERING finished jobs */
+int ndone = 0;              /* jobs ever put in donering */
+
+struct idmap_t {            /* Smallest-free-first allocator for 0..MAXJID-1 */
+  uint64_t map[MAXJID/64];      /* bit id is set while id is in use */
+  uint64_t full[MAXJID/64/64];  /* bit w is set while map[w] is all ones */
+};
+struct idmap_t jidmap;      /* job IDs in use, offset by one */
+struct idmap_t slotmap;     /* slots of jobs in use */
+
+struct cmdent_t {           /* An interned command line in cmdarena */
+  uint32_t refs;          /* jobs using it, 0 if it can be reclaimed */
+  uint32_t hash;          /* hash of the text */
+  uint32_t next;          /* next entry in the same bucket, 0 if none */
+  uint32_t len;           /* length of the text that follows */
+};
+char *cmdarena = NULL;      /* The command line arena */
+uint32_t cmdarena_size = 0; /* bytes allocated for cmdarena */
+uint32_t cmdarena_used = 0; /* bytes of cmdarena holding entries */
+uint32_t cmdarena_dead = 0; /* bytes of entries with no references */
+uint32_t *cmdbuckets = NULL; /* intern table: hash -> first handle */
+uint32_t ncmdbuckets = 0;   /* size of cmdbuckets, a power of two */
+uint32_t ncmdents = 0;      /* entries in the arena */
+
+struct builtin_t {          /* A builtin command, from builtins.def */
+  const char *name;       /* NULL in an unused slot of builtins[] */
+  int (*fn)(int argc, char **argv);  /* runs it, returning an exit status */
+  int minargs;            /* least arguments after the name */
+  int maxargs;            /* most arguments after the name, -1 for any */
+  int flags;              /* BI_* */
+};
+
+struct task_t {             /* One run of the command by parallel */
+  char *arg;              /* the argument it runs with */
+  pid_t pid;              /* 0 until it is started */
+  int status;             /* wait status, -1 until it is reaped */
+  int out;                /* with -k, a memfd holding its output, else -1 */
+};
+
+struct token_t {            /* A token from lexline */
+  int type;               /* TOK_WORD or one of the operators */
+  int fd;                 /* descriptor a redirection applies to */
+  char *text;             /* the word, or the operator as text */
+};
+struct tokens_t {           /* A growable list of tokens */
+  struct token_t *tok;
+  int n;                  /* tokens in use */
+  int cap;                /* tokens allocated */
+};
+
+struct redir_t {            /* A redirection of one descriptor */
+  int type;               /* TOK_IN, TOK_OUT, TOK_APPEND or TOK_DUPOUT */
+  int fd;                 /* descriptor being redirected */
+  char *target;           /* file name, or for TOK_DUPOUT a descriptor number or "-" */
+};
+struct stage_t {            /* A stage of a pipeline */
+  int argv;               /* index in cmdline_t.argv of its first word */
+  int redir;              /* index in cmdline_t.redir of its first redirection */
+  int nredir;             /* number of redirections, applied in order */
+};
+struct cmdline_t {          /* A command line split into pipeline stages */
+  char *buf;              /* copy of the line that lexline works on */
+  size_t bufcap;
+  struct tokens_t toks;   /* tokens of the line, pointing into buf */
+  char **argv;            /* words of every stage, each list NULL terminated */
+  int argvcap;
+  struct redir_t *redir;  /* redirections of every stage */
+  int redircap;
+  struct stage_t *stage;  /* the stages */
+  int stagecap;
+  int nstages;            /* stages in the pipeline */
+  int bg;                 /* true if the line ends in & */
+};
+
+struct cmd_t {              /* A hashed PATH lookup */
+  char *name;             /* command name as typed */
+  char *path;             /* resolved path, NULL if not found */
+  int fd;                 /* O_PATH descriptor for fexecve, or -1 */
+  int hits;               /* number of times the entry was used */
+  struct cmd_t *next;     /* next entry in the same bucket */
+};
+struct cmd_t *cmdtab[CMDHASH]; /* The command hash table */
+char *hashed_path = NULL;   /* PATH the table was built from */
+int inotify_fd = -1;        /* watches every directory in hashed_path */
+
+struct tnode_t {            /* A node of the completion trie */
+  uint32_t child;         /* first child (smallest c), 0 if none */
+  uint32_t sibling;       /* next child of the parent, 0 if none */
+  uint32_t live;          /* names ending at or below this node */
+  unsigned char c;        /* the character leading here */
+  unsigned char flags;    /* TRIE_* if a name ends here */
 };
-struct job_t jobs[MAXJOBS]; /* The job list */
+struct tnode_t *trie = NULL; /* command names; node 0 is the root */
+uint32_t ntrie = 0, triecap = 0; /* nodes in use, nodes allocated; 0: not built */
 /* End global variables */
 
 
@@ -56,9 +359,38 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
-int builtin_cmd(char **argv);
+void evalcl(struct cmdline_t *cl, int nstages, const char *text, size_t len);
+int source_script(const char *path);
+const struct builtin_t *builtin_find(const char *name);
+int builtin_run(const struct builtin_t *b, char **argv);
+int bi_quit(int argc, char **argv);
+int bi_bgfg(int argc, char **argv);
+int bi_jobs(int argc, char **argv);
+int bi_hash(int argc, char **argv);
+int bi_source(int argc, char **argv);
+int bi_echo(int argc, char **argv);
+int bi_printf(int argc, char **argv);
+int bi_true(int argc, char **argv);
+int bi_false(int argc, char **argv);
+int bi_colon(int argc, char **argv);
+int bi_test(int argc, char **argv);
+int bi_parallel(int argc, char **argv);
+int bi_admit(int argc, char **argv);
+int bi_affinity(int argc, char **argv);
+int bi_sched(int argc, char **argv);
+int bi_history(int argc, char **argv);
+int bi_compgen(int argc, char **argv);
 void do_bgfg(char **argv);
 void waitfg(pid_t pid);
+pid_t spawn_job(char **argv, pid_t pgid, int in, int out, struct redir_t *redir, int nredir,
+                const struct place_t *pl, sigset_t *sig, sigset_t *prev);
+pid_t spawn_builtin(const struct builtin_t *b, char **argv, pid_t pgid, int in, int out,
+                    struct redir_t *redir, int nredir, const struct place_t *pl, sigset_t *sig);
+int spawn_pipeline(struct cmdline_t *cl, pid_t **pidsp, sigset_t *sig, sigset_t *prev);
+int bulk_producer(const char *name);
+int redir_flags(int type);
+int redirect(struct redir_t *r, int n, int *saved);
+void unredirect(struct redir_t *r, int n, int *saved);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
@@ -68,20 +400,100 @@ int Sigaddset(sigset_t *set, int signal);
 int Setpgid(int a, int b);
 int Sigemptyset(sigset_t* set);
 int Kill(pid_t pid, int signal);
+
+void out_flush(void);
+void out_write(const char *s, size_t n);
+void out_writev(struct iovec *iov, int n);
+void out_printf(const char *fmt, ...);
+void out_vprintf(const char *fmt, va_list ap);
+char *sio_jobmsg(char *p, int jid, pid_t pid, const char *what, int sig);
+void sio_put(const char *msg, size_t n);
+void sio_job(int jid, pid_t pid, const char *what, int sig);
+
+void init_event_loop(void);
+void dispatch_signals(void);
+void wait_signals(struct job_t *job);
+char *read_cmdline(char **bufp, size_t *capp);
+
+char *resolve_cmd(char *name, int *fd);
+void do_hash(char **argv);
 /* Here are helper routines that we've provided for you */
 int parseline(const char *cmdline, char **argv); 
+int parseargs(const char *cmdline, char ***argvp);
+int parsecmd(const char *cmdline, struct cmdline_t *cl);
+int parsebuf(char *buf, size_t len, struct cmdline_t *cl);
+void syntax_error(const char *fmt, ...);
+int lexline(char *buf, size_t len, struct tokens_t *toks);
 void sigquit_handler(int sig);
 
+unsigned int hash_name(const char *name);
+struct cmd_t *hash_find(const char *name);
+struct cmd_t *hash_add(char *name);
+void hash_forget(const char *name);
+void hash_clear(void);
+void hash_sync(void);
+void comp_reset(void);
+void comp_update(const char *name);
+int comp_commands(const char *prefix);
+int comp_files(const char *word);
+
+uint32_t cmd_intern(const char *s, uint32_t len);
+void cmd_release(uint32_t h);
+void cmd_reset(void);
+char *jobcmd(struct job_t *job);
+
 void clearjob(struct job_t *job);
 void initjobs(struct job_t *jobs);
 int maxjid(struct job_t *jobs); 
+int idmap_alloc(struct idmap_t *m);
+void idmap_free(struct idmap_t *m, int id);
+void setjobstate(struct job_t *job, int state);
 int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
+int addjob_text(struct job_t *jobs, pid_t pid, int state, const char *text, size_t len);
+void addprocs(struct job_t *job, pid_t *pids, int n);
+void job_track(struct job_t *job);
+int job_kill(struct job_t *job, int sig);
+int procdone(struct job_t *job, pid_t pid, int status);
+void usage_add(struct usage_t *u, const struct rusage *ru);
+void job_retire(struct job_t *job, int status);
 int deletejob(struct job_t *jobs, pid_t pid); 
 pid_t fgpid(struct job_t *jobs);
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid); 
 int pid2jid(pid_t pid); 
 void listjobs(struct job_t *jobs);
+void listjobs_long(struct job_t *jobs);
+
+int admit_bg(const char *text, size_t len);
+void admit_enqueue(struct job_t *job);
+void admit_dequeue(struct job_t *job);
+int admit_start(struct job_t *job);
+void admit_run(void);
+int admit_timeout(void);
+void admit_poll(int fd);
+
+int cpulist_parse(const char *s, cpu_set_t *set);
+char *cpulist_format(const cpu_set_t *set, char *buf, size_t size);
+int place_for(char ***argvp, int bg, struct place_t *pl);
+int place_apply(pid_t pid, const struct place_t *pl);
+int policy_parse(const char *name);
+int ioprio_parse(const char *s);
+char *ioprio_format(int v, char *buf, size_t size);
+int hist_open(const char *path);
+void hist_init(void);
+void hist_add(const char *line);
+int hist_recall(char **bufp, size_t *capp);
+void hist_clear(void);
+void hist_list(uint64_t n);
+int hist_search(const char *s);
+void zygote_start(void);
+pid_t zygote_spawn(const char *path, int exefd, char **argv, pid_t pgid, int in, int out,
+                   struct redir_t *redir, int nredir, const struct place_t *pl);
+int job_place(struct job_t *job, const struct place_t *pl);
+char *place_format(pid_t pid, char *buf, size_t size);
+void job_renice(struct job_t *job, int inc);
+void sched_demote(struct job_t *job);
+void sched_promote(struct job_t *job);
 
 void usage(void);
 void unix_error(char *msg);
@@ -95,7 +507,9 @@ handler_t *Signal(int signum, handler_t *handler);
 int main(int argc, char **argv) 
 {
   char c;
-  char cmdline[MAXLINE];
+  char *cmdline = NULL;
+  size_t cmdcap = 0;
+  char *script = NULL; /* script to run instead of reading stdin */
   int emit_prompt = 1; /* emit prompt (default) */
 
   /* Redirect stderr to stdout (so that driver will get all output
@@ -103,7 +517,7 @@ int main(int argc, char **argv)
   dup2(1, 2);
 
   /* Parse the command line */
-  while ((c = getopt(argc, argv, "hvp")) != EOF) {
+  while ((c = getopt(argc, argv, "hvpeFzf:")) != EOF) {
     switch (c) {
       case 'h':             /* print help message */
         usage();
@@ -114,11 +528,27 @@ int main(int argc, char **argv)
       case 'p':             /* don't print a prompt */
         emit_prompt = 0;  /* handy for automatic testing */
         break;
+      case 'e':             /* run the signalfd/epoll event loop */
+        event_loop = 1;
+        break;
+      case 'F':             /* spawn jobs with plain fork+execve */
+        use_fork = 1;
+        break;
+      case 'z':             /* spawn jobs through a pre-forked zygote */
+        use_zygote = 1;
+        break;
+      case 'f':             /* batch mode: run a script file */
+        script = optarg;
+        break;
       default:
         usage();
     }
   }
 
+  /* The zygote is forked while the shell is smallest, and before its handlers */
+  if (use_zygote)
+    zygote_start();
+
   /* Install the signal handlers */
 
   /* These are the ones you will need to implement */
@@ -133,25 +563,33 @@ int main(int argc, char **argv)
   /* Initialize the job list */
   initjobs(jobs);
 
+  /* Whatever is still buffered goes out on exit */
+  atexit(out_flush);
+
+  /* In event loop mode the handlers above only ever run from the main loop */
+  if (event_loop)
+    init_event_loop();
+
+  /* Batch mode: no prompt, and no per-command flushing */
+  if (script != NULL)
+    exit(source_script(script) < 0 ? 1 : 0);  /* flushes outbuf */
+
   /* Execute the shell's read/eval loop */
   while (1) {
 
-    /* Read command line */
-    if (emit_prompt) {
-      printf("%s", prompt);
-      fflush(stdout);
-    }
-    if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-      app_error("fgets error");
-    if (feof(stdin)) { /* End of file (ctrl-d) */
-      fflush(stdout);
+    /* Read command line (the prompt goes out when read_cmdline would block) */
+    if (emit_prompt)
+      out_write(prompt, strlen(prompt));
+    if (read_cmdline(&cmdline, &cmdcap) == NULL) /* End of file (ctrl-d) */
       exit(0);
-    }
+
+    /* Expand !n and !prefix in place, and keep the line in the history */
+    if (hist_recall(&cmdline, &cmdcap) < 0)
+      continue;
+    hist_add(cmdline);
 
     /* Evaluate the command line */
     eval(cmdline);
-    fflush(stdout);
-    fflush(stdout);
   } 
 
   exit(0); /* control never reaches here */
@@ -162,8 +600,9 @@ int main(int argc, char **argv)
  * eval - Evaluate the command line that the user has just typed in
  * 
  * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
+ * then execute it immediately. Otherwise, spawn a child process for
+ * each stage of the pipeline and run the job in the context of the
+ * children (see spawn_pipeline). If the job is running in
  * the foreground, wait for it to terminate and then return.  Note:
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
@@ -171,502 +610,5554 @@ int main(int argc, char **argv)
  */
 void eval(char *cmdline) 
 {    
-  char *argv[MAXARGS]; /* array to store the command line inputs*/
-  int bkg;
-  pid_t cpid;
-  struct job_t *jbid;
-  sigset_t sig;
+  static struct cmdline_t cl;  /* the parsed command line, reused from line to line */
   if(cmdline!=NULL) /*checking if null not entered in command line*/
   {
-    bkg=parseline(cmdline,argv); 
-    if(*argv!=NULL && builtin_cmd(argv))
+    evalcl(&cl,parsecmd(cmdline,&cl),cmdline,strlen(cmdline));
+  }
+  return;
+}
+
+/*
+ * evalcl - The rest of eval, for a line that parsecmd or parsebuf has
+ *    put in cl with nstages as the result. The len bytes at text are
+ *    the line as typed, for the job table.
+ */
+void evalcl(struct cmdline_t *cl, int nstages, const char *text, size_t len)
+{
+  char **argv;         /* array to store the command line inputs*/
+  int npids, *saved, rc=0;
+  pid_t cpid, *pids;
+  struct job_t *jbid;
+  const struct builtin_t *b;
+  sigset_t sig, prev;
+  if(nstages<=0)
+  {                                               // blank line, or a syntax error that has been reported
+    return;
+  }
+  argv=cl->argv;
+  Sigemptyset(&sig);                              // emptying the signal set
+  Sigaddset(&sig,SIGCHLD);                        // adding SIGCHLD signal to the set sig
+  Sigaddset(&sig,SIGINT);                         // adding SIGINT signal to the set sig
+  Sigaddset(&sig,SIGTSTP);                        // adding SIGTSTP signal to the set sig
+  if(nstages==1 && (b=builtin_find(argv[0]))!=NULL && !(b->flags&BI_FORK) && !(cl->bg && (b->flags&BI_UTIL)))
+  {                                               // builtins only run on their own, never as a pipeline stage
+    if(b->flags&BI_JOBS)
+    {                                             // sigchld_handler changes the job table, so it waits while the builtin reads it
+      Sigprocmask(SIG_BLOCK,&sig,&prev);
+    }
+    if(cl->stage[0].nredir==0)
+    {
+      rc=builtin_run(b,argv);
+    }
+    else
+    {                                             // a builtin runs in the shell, so redirect the shell and undo it afterwards
+      if((saved=malloc((cl->stage[0].nredir+1)*sizeof(int)))==NULL)
+      {
+        unix_error("malloc error");
+      }
+      out_flush();
+      if(redirect(cl->redir,cl->stage[0].nredir,saved)==0)
+      {
+        rc=builtin_run(b,argv);
+      }
+      out_flush();
+      unredirect(cl->redir,cl->stage[0].nredir,saved);
+      free(saved);
+    }
+    if(b->flags&BI_JOBS)
+    {
+      Sigprocmask(SIG_SETMASK,&prev,NULL);
+    }
+    if(rc!=BI_EXTERNAL)
+    {
+      return;
+    }                                             // left to the program it stands in for
+  }
+  Sigprocmask(SIG_BLOCK,&sig,&prev);              // blocking the set so that the child cannot be reaped before it is in the jobs table
+  if(cl->bg && !admit_bg(text,len))
+  {                                               // over the admission limits: queued, admit_run starts it later
+    Sigprocmask(SIG_SETMASK,&prev,NULL);
+    return;
+  }
+  if((npids=spawn_pipeline(cl,&pids,&sig,&prev))==0)
+  { /* command could not be started, nothing to add to the jobs table */
+    Sigprocmask(SIG_SETMASK,&prev,NULL);
+  }
+  else
+  {
+    cpid=pids[0];                               // the first stage leads the process group and names the job
+    if(!cl->bg)
     {
-      if(sigemptyset(&sig)==-1)
-      { 
-        unix_error("sigemptyset error"); 
-      }// emptying the signal set                              
-
-      if(sigaddset(&sig,SIGCHLD))
-      {  
-         unix_error("sigaddset error");
-      }// adding SIGCHLD signal to the set sig                                                
-
-      if(sigaddset(&sig,SIGINT))
-      {  
-        unix_error("sigaddset error");
-      }// adding SIGINT signal to the set sig                                   
-
-      if(sigaddset(&sig,SIGSTOP))
-      {  
-        unix_error("sigaddset error");
-      }// adding SIGSTOP signal to the set sig
-      
-      if(sigprocmask(SIG_UNBLOCK,&sig,NULL)==-1)
+      if(addjob_text(jobs, cpid, FG, text, len))  // add foreground job           
+      {
+        addprocs(getjobpid(jobs,cpid),pids,npids);
+        job_track(getjobpid(jobs,cpid));
+      }
+      else
+      {                                         // no room to track it, so it must not run behind the shell's back
+        kill(-cpid,SIGKILL);
+      }
+      if(sigprocmask(SIG_SETMASK,&prev,NULL)==-1)
       {   
         unix_error("sigprocmask error");
-      }// blocking/masking the set so that the parent does not recieve any signal 
-
-      if((cpid=fork())==0)
-      { /* creating child process forr non-builtin command execution*/
-        if(sigprocmask(SIG_UNBLOCK,&sig,NULL)==-1)
-        {   
-          unix_error("sigprocmask error");
-        } /*unblocking/unmasking for child process */
-        setpgid(0,0);                         /* setting the group id of command that is to be executed*/
-        if(execve(argv[0],argv,environ)<0)
-        {        /* executing the non-builltin command using execve system call*/
-          printf("%s: Command not found\n",argv[0] );
-          exit(1);
-        }                         
+      }      // unblocking the set for parent as the child is added in jobs table and thus now parent will recieve signals
+      waitfg(cpid);
+                               //wait until fg process is completed  
+
+    } 
+    else
+    {
+      if(addjob_text(jobs, cpid, BG, text, len))     
+      {       // adding  background job                                  
+        addprocs(getjobpid(jobs,cpid),pids,npids);
+        job_track(getjobpid(jobs,cpid));
+        getjobpid(jobs,cpid)->penalty=sched_boost;  // spawn_pipeline started it that much nicer
       }
       else
       {
-               
-        if(!bkg)
-        {
-          addjob(jobs, cpid, FG, cmdline);    // add foreground job           
-          if(sigprocmask(SIG_UNBLOCK,&sig,NULL)==-1)
-          {   
-            unix_error("sigprocmask error");
-          }      // unblocking the set for parent as the child is added in jobs table and thus now parent will recieve signals
-          waitfg(cpid);
-                                   //wait until fg process is completed  
-
-        } 
-        else
-        {
-          addjob(jobs, cpid, BG, cmdline);     
-                  // adding  background job                                  
-          if(sigprocmask(SIG_UNBLOCK,&sig,NULL)==-1)
-          {   
-            unix_error("sigprocmask error");
-          }// unblocking the set for parent  as the child is added in jobs table and thus now parent will recieve signals                   
-          jbid = getjobpid(jobs, cpid);                
-          // get the job from the process id                          
-          printf("[%d] (%d) %s\n", jbid->jid, jbid->pid, jbid->cmdline);                                  
-        }
+        kill(-cpid,SIGKILL);
+      }
+      if((jbid = getjobpid(jobs, cpid))!=NULL)
+      {     // get the job from the process id, before it can exit and be reaped
+        out_printf("[%d] (%d) %s\n", jbid->jid, jbid->pid, jobcmd(jbid));                                  
       }
-    }               
+      if(sigprocmask(SIG_SETMASK,&prev,NULL)==-1)
+      {   
+        unix_error("sigprocmask error");
+      }// unblocking the set for parent  as the child is added in jobs table and thus now parent will recieve signals                   
+    }
   }
   return;
 }
-/* 
- * parseline - Parse the command line and build the argv array.
- * 
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
+
+/*
+ * source_script - Run the commands in the file path, one per line.
+ *    The file is mapped twice: a private copy-on-write mapping, backed
+ *    by zero pages past the end, that each line is parsed in place in,
+ *    and a read-only one that keeps the text as written for the job
+ *    table. Nothing is read or copied a line at a time. A line that
+ *    does not parse is reported with its line number and skipped.
+ *    Returns 0, or -1 if the file could not be opened or mapped.
  */
-int parseline(const char *cmdline, char **argv) 
+int source_script(const char *path)
 {
-  static char array[MAXLINE]; /* holds local copy of command line */
-  char *buf = array;          /* ptr that traverses command line */
-  char *delim;                /* points to first space delimiter */
-  int argc;                   /* number of args */
-  int bg;                     /* background job? */
-  strcpy(buf, cmdline);
-  buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space */
-  while (*buf && (*buf == ' ')) /* ignore leading spaces */
-    buf++;
-
-  /* Build the argv list */
-  argc = 0;
-  if (*buf == '\'') {
-    buf++;
-    delim = strchr(buf, '\'');
+  struct cmdline_t cl;            // not eval's: a script can source another
+  struct stat st;
+  char *buf, *text, *p, *end, *nl;
+  size_t size, span, page;
+  const char *oldname = script_name;
+  int oldline = script_line, fd, n;
+
+  if((fd=open(path,O_RDONLY|O_CLOEXEC))<0 || fstat(fd,&st)<0)
+  {
+    out_printf("%s: %s\n",path,strerror(errno));
+    if(fd>=0)
+    {
+      close(fd);
+    }
+    return -1;
   }
-  else {
-    delim = strchr(buf, ' ');
+  if((size=st.st_size)==0)
+  {
+    close(fd);
+    return 0;
   }
 
-  while (delim) {
-    argv[argc++] = buf;
-    *delim = '\0';
-    buf = delim + 1;
-    while (*buf && (*buf == ' ')) /* ignore spaces */
-      buf++;
+  page=sysconf(_SC_PAGESIZE);
+  span=(size+1+LEXPAD+page-1)/page*page;         // room to NUL terminate the last line and for lexline to read past it
+  buf=mmap(NULL,span,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(buf==MAP_FAILED || mmap(buf,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,0)==MAP_FAILED ||
+     (text=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0))==MAP_FAILED)
+  {
+    out_printf("%s: %s\n",path,strerror(errno));
+    if(buf!=MAP_FAILED)
+    {
+      munmap(buf,span);
+    }
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  madvise(buf,size,MADV_SEQUENTIAL);
 
-    if (*buf == '\'') {
-      buf++;
-      delim = strchr(buf, '\'');
+  memset(&cl,0,sizeof(cl));
+  script_name=path;
+  script_line=0;
+  end=buf+size;
+  for(p=buf;p<end;p=nl+1)
+  {
+    script_line++;
+    if((nl=memchr(p,'\n',end-p))==NULL)
+    {
+      nl=end;                                      // last line without a newline; the byte after it is padding
     }
-    else {
-      delim = strchr(buf, ' ');
+    n=parsebuf(p,nl-p+(nl<end),&cl);               // only writes inside the line, so later lines are untouched
+    evalcl(&cl,n,text+(p-buf),nl-p+(nl<end));
+    if(event_loop)
+    {
+      dispatch_signals();                          // nothing else reads the signalfd between foreground jobs
     }
+    admit_run();
   }
-  argv[argc] = NULL;
-
-  if (argc == 0)  /* ignore blank line */
-    return 1;
+  script_name=oldname;
+  script_line=oldline;
 
-  /* should the job run in the background? */
-  if ((bg = (*argv[argc-1] == '&')) != 0) {
-    argv[--argc] = NULL;
-  }
-  return bg;
+  munmap(text,size);
+  munmap(buf,span);
+  free(cl.toks.tok);
+  free(cl.argv);
+  free(cl.redir);
+  free(cl.stage);
+  return 0;
 }
 
-/* 
- * builtin_cmd - If the user has typed a built-in command then execute
- *    it immediately.  
+/*
+ * bulk_producer - True if name is a command that is known to write a
+ *    lot of data, so the pipe it writes into is worth enlarging
  */
-int builtin_cmd(char **argv) 
+int bulk_producer(const char *name)
 {
-           
-  if(strcmp(*argv,"quit")==0)//if quit command written
-  {                                 
-    int i;
-    for(i=0;i<MAXJOBS;i++)
-    {
-      if(jobs[i].state==ST)
-      {//check for stopped jobs and printing them
-        printf("[%d] (%d) Stopped", jobs[i].jid, jobs[i].pid);
-      }
-    }
-    exit(0); // closing the shell
-  }
-  else if(strcmp(*argv,"fg")==0 || strcmp(*argv,"bg")==0) //if cmd argument is fg or bg then pass that argument likewise to do_bgfg function
-  {
-    do_bgfg(argv);
-    return 0;
-  }
- 
-  else if(strcmp(*argv,"jobs")==0) //if cmd argument is jobs then list jobs
-  {
-    listjobs(jobs);
-    return 0; 
-  }
-  return 1; 
-  /* not a builtin command 
-     return 0 when builtin
-     return 1 when not builtin
-  */
+  static const char *bulkcmds[] = {
+    "cat", "zcat", "gzip", "gunzip", "bzip2", "xz", "zstd",
+    "tar", "dd", "find", "sort", "seq", "yes", NULL
+  };
+  const char *base = strrchr(name, '/');
+  int i;
+
+  base = (base == NULL) ? name : base + 1;
+  for (i = 0; bulkcmds[i] != NULL; i++)
+    if (strcmp(base, bulkcmds[i]) == 0)
+      return 1;
+  return 0;
 }
 
-/* 
- * do_bgfg - Execute the builtin bg and fg commands
+/*
+ * spawn_pipeline - Start every stage of cl, each one's output piped into
+ *    the next one's input, in a single process group led by the first
+ *    stage that could be started. A stage that cannot be run is
+ *    reported and left out; its neighbours just see end of file or a
+ *    broken pipe. Returns the number of processes started, with their
+ *    pids in *pidsp (valid until the next call).
  */
-void do_bgfg(char **argv) 
+int spawn_pipeline(struct cmdline_t *cl, pid_t **pidsp, sigset_t *sig, sigset_t *prev)
 {
-  int jid=0;
-  struct job_t *job_det=NULL;
-  
-    if(argv[1]==NULL)
-    { // if we dont have anything written as input after fg or bg then its null and thus to print this
-      printf("%s command requires PID or %% jobid argument\n",argv[0]);
-      return;
+  static pid_t *pids = NULL;       // pids of the stages that were started
+  static int pidscap = 0;
+  int fds[2], in = -1, out, i, n = 0, place;
+  pid_t pgid = 0, cpid;
+  char **argv;
+  struct place_t pl;
+
+  out_flush();                     // the children share fd 1, so what the shell has buffered goes first
+
+  if(cl->nstages>pidscap)
+  {
+    pidscap=2*cl->nstages;
+    if((pids=realloc(pids,pidscap*sizeof(pid_t)))==NULL)
+    {
+      unix_error("realloc error");
     }
-    else//if something is written after fg or bg
-    { 
-      if((argv[1][0]=='%'))//if first character of second argumeng is %
-      {                                                         
+  }
 
-        jid=atoi(&argv[1][1]); //getting job id which will be the second character of the second argument
-        job_det=getjobjid(jobs,jid); 
-        // getting the job details from the given jobid
-        if(job_det==NULL)
-        {                                                          
-          printf("%%%d: No such job\n",jid);                                      
-          return;
-        }
-      }        
-      else if(argv[1][0]>=48 && argv[1][0]<=57) // if second argument starts with a digit ie checking if it is a process id or not
-      {                                        
-        jid=atoi(&argv[1][0]);     // getting the process id from second argument 
-        job_det= getjobpid(jobs,jid);    
-        // getting the job details from the given process id
-        if(job_det==NULL)
-        {                                                            
-          printf("(%d): No such process\n",jid);                                   
-          return;                      
-        }
-      } 
-    
-      else//if second arguments first character neither a % nor a digit the it aint valid
-      { 
-        printf("%s command requires PID or %% jobid\n",argv[0]);            
-        return;                
+  for(i=0;i<cl->nstages;i++)
+  {
+    argv=cl->argv+cl->stage[i].argv;
+    place=place_for(&argv,cl->bg,&pl);             // takes off the @cpus=, @nice=, ... prefixes
+    out=-1;
+    if(i<cl->nstages-1)
+    {                                              // close-on-exec, so no other child keeps the pipe open
+      if(pipe2(fds,O_CLOEXEC)<0)
+      {
+        unix_error("pipe2 error");
       }
-                  
-      kill(-(job_det->pid),SIGCONT);     //continuing the stopped execution
-
-      if(strcmp(argv[0],"fg")==0)  //for foregroung
+      if(bulk_producer(argv[0]))
       {
-        job_det->state=FG;  
-         //making state of foreground jobs to FG
-        waitfg(job_det->pid); //waiting for foreground job to terminate
+        fcntl(fds[1],F_SETPIPE_SZ,PIPEBIG);        // best effort: beyond /proc/sys/fs/pipe-max-size this fails and the pipe keeps its size
       }
-      else // for backgroung
+      out=fds[1];
+    }
+    cpid=0;
+    if(place>=0)
+    {                                              // else the prefix was bad, which has been reported
+      cpid=spawn_job(argv,pgid,in,out,cl->redir+cl->stage[i].redir,cl->stage[i].nredir,&pl,sig,prev);
+    }
+    if(cpid>0)
+    {
+      pids[n++]=cpid;
+      if(pgid==0)
       {
-        job_det->state =BG;                        
-        //making state of background jobs to BG
+        pgid=cpid;
+      }
+    }
+    if(in>=0)
+    {
+      close(in);                                   // the stages have their own copies now
+    }
+    if(out>=0)
+    {
+      close(out);
+    }
+    in=(i<cl->nstages-1) ? fds[0] : -1;
+  }
+  *pidsp=pids;
+  return n;
+}
 
-        printf("[%d] (%d) %s",job_det->jid,job_det->pid,job_det->cmdline);                                      
-      }    
-    }    
-                 
-  return;
-}                    
 /*
- * waitfg - Block until process pid is no longer the foreground process
+ * spawn_job - Start argv[0] in process group pgid (a new one of its
+ *    own if pgid is 0), with the job control signals in sig unblocked
+ *    and set back to their defaults, with in and out (unless -1) as its
+ *    standard input and output, and then the nredir redirections at
+ *    redir applied in order, and placed as pl says from before its
+ *    exec, or with posix_spawn, for all but the CPUs, right after it
+ *    (glibc's attributes take no nice value, I/O priority, or policy
+ *    but FIFO, RR and OTHER). By default this uses posix_spawn,
+ *    which glibc runs on a vfork-style clone so its cost does not grow
+ *    with the size of the shell; -F selects plain fork+execve instead,
+ *    and -z has the zygote fork it.
+ *    Returns the child's pid, or 0 if the command could not be run.
+ *    Names without a '/' are looked up on PATH through the command
+ *    hash table.
  */
-void waitfg(pid_t pid)
+pid_t spawn_job(char **argv, pid_t pgid, int in, int out, struct redir_t *redir, int nredir,
+                const struct place_t *pl, sigset_t *sig, sigset_t *prev)
 {
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t acts, *actsp = NULL;
+  sigset_t child_mask;
+  cpu_set_t shell_cpus;
+  struct place_t after;
+  pid_t cpid;
+  char *path;
+  int err, fd, i;
+  const struct builtin_t *b;
 
-  struct job_t *jb=getjobpid(jobs,pid);       // get job from the process pid
-  if(jb==NULL)
-  {                                                       
-   return;
+  if((b=builtin_find(argv[0]))!=NULL && (b->flags&BI_FORK))
+  {                                                // nothing to exec: the shell itself runs it, in a fork
+    return spawn_builtin(b,argv,pgid,in,out,redir,nredir,pl,sig);
+  }
+  if((path=resolve_cmd(argv[0],&fd))==NULL)
+  {                                                // not on PATH, no need to start anything
+    out_printf("%s: Command not found\n",argv[0]);
+    return 0;
   }
-  while(jb->pid==pid && jb->state==FG)
-  {                                                     // check if this job is a foreground process
-   sleep(1);                                            // if yes then sleep for 1s
-  } 
-  return;
-}
-
-/*****************
- * Signal handlers
- *****************/
-
-/* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.  
- */
 
-void sigchld_handler(int sig) 
-{
-      pid_t ps=fgpid(jobs);                                             
-      int status;
-      pid_t pid;
-      while((pid = waitpid(ps, &status, WNOHANG|WUNTRACED)) > 0) 
-      {       
+  if(zygote_fd>=0 && (cpid=zygote_spawn(path,fd,argv,pgid,in,out,redir,nredir,pl))>=0)
+  {                                                // on -1 the zygote cannot take it, so it is started here after all
+    if(cpid>0)
+    {
+      setpgid(cpid,pgid);                          // the shell's child (CLONE_PARENT), so as in the fork path
+    }
+    return cpid;
+  }
 
-        if (WIFSTOPPED(status))
-        {                                          // If child terminated due to sigtstp signal
-            sigtstp_handler(20);
-        }
-        else if (WIFSIGNALED(status))
-        {                                    // If child terminated due to sigint signal ie interupt then this method called
-            sigint_handler(-2);
-        }
-        else if (WIFEXITED(status))
-        {                                      // If child terminated normally the delete it
-            deletejob(jobs, pid);
-        }
+  if(use_fork)
+  {
+    if((cpid=fork())<0)
+    {
+      unix_error("fork error");
+    }
+    if(cpid==0)
+    { /* creating child process forr non-builtin command execution*/
+      if(sigprocmask(SIG_UNBLOCK,sig,NULL)==-1)
+      {   
+        unix_error("sigprocmask error");
+      } /*unblocking/unmasking for child process */
+      setpgid(0,pgid);                      /* setting the group id of command that is to be executed*/
+      if(place_apply(0,pl)<0)
+      {
+        out_printf("%s: %s\n",argv[0],strerror(errno));
+        exit(1);
       }
-      return;
-}
+      if(in>=0)
+      {
+        dup2(in,STDIN_FILENO);              /* the copies are not close-on-exec, the pipe ends are */
+      }
+      if(out>=0)
+      {
+        dup2(out,STDOUT_FILENO);
+      }
+      if(redirect(redir,nredir,NULL)<0)
+      {                                     /* the reason has been printed */
+        exit(1);
+      }
+      if(fd>=0)
+      {
+        fexecve(fd,argv,environ);           /* run exactly the file that was hashed; scripts fall through to execve */
+      }
+      if(execve(path,argv,environ)<0)
+      {        /* executing the non-builltin command using execve system call*/
+        out_printf("%s: Command not found\n",argv[0] );
+        exit(1);
+      }                         
+    }
+    setpgid(cpid,pgid);                     /* also from here, so the group exists before the next stage joins it */
+    return cpid;
+  }
 
+  child_mask=*prev;                                // what the child would have had after unblocking in the fork path
+  sigdelset(&child_mask,SIGCHLD);
+  sigdelset(&child_mask,SIGINT);
+  sigdelset(&child_mask,SIGTSTP);
+
+  if((err=posix_spawnattr_init(&attr))!=0)
+  {
+    errno=err;
+    unix_error("posix_spawnattr_init error");
+  }
+  posix_spawnattr_setflags(&attr,POSIX_SPAWN_SETPGROUP|POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+  posix_spawnattr_setpgroup(&attr,pgid);           // same as setpgid(0,pgid) in the child
+  posix_spawnattr_setsigmask(&attr,&child_mask);
+  posix_spawnattr_setsigdefault(&attr,sig);        // no shell handler may run between clone and exec
+  if(in>=0 || out>=0 || nredir>0)
+  {                                                // only pipeline stages and redirected commands pay for file actions
+    posix_spawn_file_actions_init(&acts);
+    if(in>=0)
+    {
+      posix_spawn_file_actions_adddup2(&acts,in,STDIN_FILENO);
+    }
+    if(out>=0)
+    {
+      posix_spawn_file_actions_adddup2(&acts,out,STDOUT_FILENO);
+    }
+    for(i=0;i<nredir;i++)
+    {                                              // the same steps redirect() takes in the fork path
+      if(redir[i].type!=TOK_DUPOUT)
+      {
+        posix_spawn_file_actions_addopen(&acts,redir[i].fd,redir[i].target,redir_flags(redir[i].type),0666);
+      }
+      else if(strcmp(redir[i].target,"-")==0)
+      {
+        posix_spawn_file_actions_addclose(&acts,redir[i].fd);
+      }
+      else if((err=posix_spawn_file_actions_adddup2(&acts,atoi(redir[i].target),redir[i].fd))!=0)
+      {
+        out_printf("%s: %s\n",redir[i].target,strerror(err));
+        posix_spawn_file_actions_destroy(&acts);
+        posix_spawnattr_destroy(&attr);
+        return 0;
+      }
+    }
+    actsp=&acts;
+  }
+
+  if(pl->set&PL_CPUS)
+  {                                                // posix_spawn has no affinity attribute, but the clone inherits the
+    sched_getaffinity(0,sizeof(shell_cpus),&shell_cpus);   // mask of the thread calling it: the shell takes on the job's for the call
+    if(sched_setaffinity(0,sizeof(cpu_set_t),&pl->cpus)<0)
+    {
+      out_printf("%s: %s\n",argv[0],strerror(errno));
+      if(actsp!=NULL)
+      {
+        posix_spawn_file_actions_destroy(actsp);
+      }
+      posix_spawnattr_destroy(&attr);
+      return 0;
+    }
+  }
+  err=posix_spawn(&cpid,path,actsp,&attr,argv,environ);
+  if(pl->set&PL_CPUS)
+  {
+    sched_setaffinity(0,sizeof(shell_cpus),&shell_cpus);
+  }
+  posix_spawnattr_destroy(&attr);
+  if(actsp!=NULL)
+  {
+    posix_spawn_file_actions_destroy(actsp);
+  }
+  if(err!=0)
+  {
+    for(i=0;i<nredir;i++)
+    {                                              // posix_spawn does not say which step failed: the child got past the
+      if(redir[i].type!=TOK_DUPOUT)                // ones before it, so redoing them here changes nothing and finds it
+      {
+        if((fd=open(redir[i].target,redir_flags(redir[i].type)&~O_TRUNC,0666))<0)
+        {
+          out_printf("%s: %s\n",redir[i].target,strerror(errno));
+          return 0;
+        }
+        close(fd);
+      }
+    }
+    out_printf("%s: Command not found\n",argv[0]);
+    return 0;
+  }
+  after=*pl;
+  after.set&=~PL_CPUS;
+  if(after.set!=0 && place_apply(cpid,&after)<0)
+  {                                                // it must not go on running unplaced; as no job holds it, it is reaped like any stray child
+    out_printf("%s: %s\n",argv[0],strerror(errno));
+    kill(cpid,SIGKILL);
+    return 0;
+  }
+  return cpid;
+}
+
+/*
+ * spawn_builtin - Start BI_FORK builtin b the way spawn_job starts a
+ *    program: in a child of the shell, in process group pgid, with in,
+ *    out and the redirections applied. The child puts the job control
+ *    signals back to their defaults before it unblocks them, since the
+ *    shell's handlers and job table mean nothing there, and exits with
+ *    the builtin's status. It is placed as pl says, and so is
+ *    everything it starts. Returns the child's pid.
+ */
+pid_t spawn_builtin(const struct builtin_t *b, char **argv, pid_t pgid, int in, int out,
+                    struct redir_t *redir, int nredir, const struct place_t *pl, sigset_t *sig)
+{
+  pid_t cpid;
+
+  if((cpid=fork())<0)
+  {
+    unix_error("fork error");
+  }
+  if(cpid==0)
+  {
+    signal(SIGCHLD,SIG_DFL);
+    signal(SIGINT,SIG_DFL);
+    signal(SIGTSTP,SIG_DFL);
+    signal(SIGQUIT,SIG_DFL);
+    event_loop=0;                           // the signalfd is the shell's, signals are delivered here as usual
+    if(sigprocmask(SIG_UNBLOCK,sig,NULL)==-1)
+    {
+      unix_error("sigprocmask error");
+    }
+    setpgid(0,pgid);
+    if(place_apply(0,pl)<0)
+    {
+      out_printf("%s: %s\n",argv[0],strerror(errno));
+      exit(1);
+    }
+    if(in>=0)
+    {
+      dup2(in,STDIN_FILENO);
+      close(in);                            // no exec to close it: the pipe would stay open behind fd 0
+    }
+    if(out>=0)
+    {
+      dup2(out,STDOUT_FILENO);
+      close(out);
+    }
+    if(redirect(redir,nredir,NULL)<0)
+    {
+      exit(1);
+    }
+    exit(builtin_run(b,argv));              // outbuf is empty after spawn_pipeline's flush, and exit flushes it again
+  }
+  setpgid(cpid,pgid);
+  return cpid;
+}
+
+/* redir_flags - open(2) flags for a redirection of the given type */
+int redir_flags(int type)
+{
+  switch (type) {
+    case TOK_IN:
+      return O_RDONLY;
+    case TOK_APPEND:
+      return O_WRONLY | O_CREAT | O_APPEND;
+    default:
+      return O_WRONLY | O_CREAT | O_TRUNC;
+  }
+}
+
+/*
+ * redirect - Apply the n redirections at r to this process, in order.
+ *    If saved is not NULL (it needs room for n+1 entries), saved[i]
+ *    gets a close-on-exec copy of what
+ *    descriptor r[i].fd was before (-1 if it was not open) so that
+ *    unredirect can put it back. Returns 0, or -1 after reporting the
+ *    redirection that failed (undo the ones before it with unredirect).
+ */
+int redirect(struct redir_t *r, int n, int *saved)
+{
+  int i, src;
+
+  for (i = 0; i < n; i++) {
+    if (saved != NULL) {
+      saved[i] = fcntl(r[i].fd, F_DUPFD_CLOEXEC, 10);
+      saved[i + 1] = -2;   /* marks where to stop undoing on failure */
+    }
+    if (r[i].type != TOK_DUPOUT)
+      src = open(r[i].target, redir_flags(r[i].type), 0666);
+    else if (strcmp(r[i].target, "-") == 0) {
+      close(r[i].fd);
+      continue;
+    }
+    else if (fcntl(src = atoi(r[i].target), F_GETFD) < 0)
+      src = -1;
+    if (src < 0) {
+      out_printf("%s: %s\n", r[i].target, strerror(errno));
+      return -1;
+    }
+    if (src != r[i].fd) {
+      if (dup2(src, r[i].fd) < 0) {
+        out_printf("%d: %s\n", r[i].fd, strerror(errno));
+        return -1;
+      }
+      if (r[i].type != TOK_DUPOUT)
+        close(src);
+    }
+  }
+  return 0;
+}
+
+/*
+ * unredirect - Undo what redirect did with the same r and saved, last
+ *    redirection first
+ */
+void unredirect(struct redir_t *r, int n, int *saved)
+{
+  int i;
+
+  for (i = 0; i < n && saved[i] != -2; i++)
+    ;
+  while (--i >= 0) {
+    if (saved[i] >= 0) {
+      dup2(saved[i], r[i].fd);
+      close(saved[i]);
+    }
+    else
+      close(r[i].fd);
+  }
+}
+/***********************************************************
+ * Command line lexer
+ *
+ * lexline() splits a line into words and operators in place. Each
+ * byte is classified through lexclass[] and the state machine in
+ * lextab[] picks what to do with it. Inside a word or a quoted string
+ * most bytes are ordinary, so before lexing, the blanks, quotes and
+ * backslashes of the whole line are located 64 bytes at a time with
+ * SSE2 or AVX2 compares (lexmask). A run of ordinary bytes is then
+ * skipped with a single bit scan (lexrun), and only moved if quote or
+ * escape removal has opened a gap behind it.
+ *
+ * Operators (& | ; < > >> >&, optionally with a descriptor number in
+ * front as in 2>&1) are only recognised at the start of a token, and
+ * outside quotes a backslash only escapes blanks, quotes, backslashes
+ * and operator characters. Both keep lines like the trace files'
+ * "/bin/echo -e tsh> ./myspin 1 \046" meaning what they always have.
+ ***********************************************************/
+
+/* Character classes */
+#define C_ORD    0  /* anything else */
+#define C_SPACE  1  /* blank or newline */
+#define C_SQ     2  /* ' */
+#define C_DQ     3  /* " */
+#define C_BS     4  /* \ */
+#define C_OP     5  /* & | ; < > */
+#define C_END    6  /* end of the line */
+
+/* Lexer states */
+#define S_GAP    0  /* between tokens */
+#define S_WORD   1  /* in a word, outside quotes */
+#define S_SQ     2  /* inside '...' */
+#define S_DQ     3  /* inside "..." */
+
+/* Actions */
+#define A_SKIP   0  /* drop a blank between tokens */
+#define A_BEGIN  1  /* start a word here, then look at this byte again */
+#define A_OP     2  /* read an operator */
+#define A_RUN    3  /* copy a run of ordinary bytes */
+#define A_COPY   4  /* copy one byte */
+#define A_END    5  /* finish the current word */
+#define A_ESC    6  /* backslash outside quotes */
+#define A_DQESC  7  /* backslash inside double quotes */
+#define A_SQ     8  /* enter or leave single quotes */
+#define A_DQ     9  /* enter or leave double quotes */
+#define A_DONE  10  /* end of line between tokens */
+#define A_ERR   11  /* end of line inside quotes */
+
+static unsigned char lexclass[256];
+
+static const unsigned char lextab[4][7] = {
+  /*           ORD     SPACE   SQ      DQ      BS       OP      END   */
+  /* GAP  */ { A_BEGIN, A_SKIP, A_BEGIN, A_BEGIN, A_BEGIN, A_OP,   A_DONE },
+  /* WORD */ { A_RUN,   A_END,  A_SQ,    A_DQ,    A_ESC,   A_COPY, A_END  },
+  /* SQ   */ { A_RUN,   A_COPY, A_SQ,    A_COPY,  A_COPY,  A_COPY, A_ERR  },
+  /* DQ   */ { A_RUN,   A_COPY, A_COPY,  A_DQ,    A_DQESC, A_COPY, A_ERR  },
+};
+
+int lexsimd = -1;           /* 0 scalar, 1 SSE2, 2 AVX2, -1 pick at first use */
+char *lexerr = NULL;        /* why the last lexline failed */
+static uint64_t *lexmask = NULL;   /* bit i set if line[i] may end a run */
+static size_t lexmaskcap = 0;      /* 64-bit words allocated in lexmask */
+
+/*
+ * A run of ordinary bytes ends at a blank, a quote or a backslash,
+ * whatever the state (inside quotes only some of those matter, and
+ * lexrun skips the others). lexmask_* set bit i of a 64-bit word for
+ * each such byte in a 64-byte block.
+ */
+
+/* lexmask_scalar - Stop bits for the n <= 64 bytes at p */
+static uint64_t lexmask_scalar(const char *p, size_t n)
+{
+  uint64_t m = 0;
+  size_t i;
+  int c;
+
+  for (i = 0; i < n; i++) {
+    c = lexclass[(unsigned char)p[i]];
+    if (c != C_ORD && c != C_OP)
+      m |= (uint64_t)1 << i;
+  }
+  return m;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* lexmask_sse2 - Stop bits for the 64 bytes at p, 16 at a time */
+__attribute__ ((target("sse2")))
+static uint64_t lexmask_sse2(const char *p)
+{
+  uint64_t m = 0;
+  __m128i v, e;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+    e = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\''))));
+    e = _mm_or_si128(e, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+    m |= (uint64_t)(unsigned int)_mm_movemask_epi8(e) << (16 * i);
+  }
+  return m;
+}
+
+/* lexmask_avx2 - Stop bits for the 64 bytes at p, 32 at a time */
+__attribute__ ((target("avx2")))
+static uint64_t lexmask_avx2(const char *p)
+{
+  uint64_t m = 0;
+  __m256i v, e;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    v = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+    e = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))));
+    e = _mm256_or_si256(e, _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+    m |= (uint64_t)(unsigned int)_mm256_movemask_epi8(e) << (32 * i);
+  }
+  return m;
+}
+#endif
+
+/* lexmask_build - Fill lexmask for buf[0..len) */
+static void lexmask_build(const char *buf, size_t len)
+{
+  size_t i, nwords = len / 64 + 1;
+
+  if (nwords > lexmaskcap) {
+    lexmaskcap = 2 * nwords;
+    if ((lexmask = realloc(lexmask, lexmaskcap * sizeof(uint64_t))) == NULL)
+      unix_error("realloc error");
+  }
+  /* the last block may read into the LEXPAD bytes past len; the bits
+     for those are masked off */
+  for (i = 0; i <= len; i += 64) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (lexsimd == 2)
+      lexmask[i / 64] = lexmask_avx2(buf + i);
+    else if (lexsimd == 1)
+      lexmask[i / 64] = lexmask_sse2(buf + i);
+    else
+#endif
+      lexmask[i / 64] = lexmask_scalar(buf + i, (len - i < 64) ? len - i : 64);
+  }
+  if (len % 64)
+    lexmask[len / 64] &= ((uint64_t)1 << (len % 64)) - 1;
+  else
+    lexmask[len / 64] = 0;
+}
+
+/*
+ * lexrun - End of the run of ordinary bytes that starts at buf[i]:
+ *    the first byte after it that lexmask marks and that matters in
+ *    state, or len
+ */
+static size_t lexrun(const char *buf, size_t i, size_t len, int state)
+{
+  size_t wi;
+  uint64_t m;
+
+  while (1) {
+    if (++i >= len)
+      return len;
+    wi = i / 64;
+    m = lexmask[wi] & (~(uint64_t)0 << (i % 64));
+    while (m == 0) {
+      if (++wi > len / 64)
+        return len;
+      m = lexmask[wi];
+    }
+    i = wi * 64 + __builtin_ctzll(m);
+    if (state == S_WORD || (state == S_SQ && buf[i] == '\'') ||
+        (state == S_DQ && (buf[i] == '"' || buf[i] == '\\')))
+      return i;
+  }
+}
+
+/* lexinit - Fill in the class table and pick the SIMD flavour */
+static void lexinit(void)
+{
+  const char *p;
+
+  for (p = " \t\n"; *p; p++)
+    lexclass[(unsigned char)*p] = C_SPACE;
+  for (p = "&|;<>"; *p; p++)
+    lexclass[(unsigned char)*p] = C_OP;
+  lexclass['\''] = C_SQ;
+  lexclass['"'] = C_DQ;
+  lexclass['\\'] = C_BS;
+
+  if (lexsimd < 0) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    lexsimd = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse2") ? 1 : 0;
+#else
+    lexsimd = 0;
+#endif
+  }
+}
+
+/* lexpush - Append a token, growing the list as needed */
+static void lexpush(struct tokens_t *toks, int type, int fd, char *text)
+{
+  if (toks->n == toks->cap) {
+    toks->cap = (toks->cap == 0) ? 16 : 2 * toks->cap;
+    if ((toks->tok = realloc(toks->tok, toks->cap * sizeof(struct token_t))) == NULL)
+      unix_error("realloc error");
+  }
+  toks->tok[toks->n].type = type;
+  toks->tok[toks->n].fd = fd;
+  toks->tok[toks->n].text = text;
+  toks->n++;
+}
+
+/*
+ * lexop - Read the operator at r, preceded by a descriptor number if
+ *    fd >= 0, and return the position just after it
+ */
+static char *lexop(char *r, char *end, int fd, struct tokens_t *toks)
+{
+  switch (*r) {
+    case '&':
+      lexpush(toks, TOK_BG, -1, "&");
+      return r + 1;
+    case '|':
+      lexpush(toks, TOK_PIPE, -1, "|");
+      return r + 1;
+    case ';':
+      lexpush(toks, TOK_SEMI, -1, ";");
+      return r + 1;
+    case '<':
+      lexpush(toks, TOK_IN, (fd < 0) ? 0 : fd, "<");
+      return r + 1;
+  }
+  if (fd < 0)
+    fd = 1;
+  if (r + 1 < end && r[1] == '>') {
+    lexpush(toks, TOK_APPEND, fd, ">>");
+    return r + 2;
+  }
+  if (r + 1 < end && r[1] == '&') {
+    lexpush(toks, TOK_DUPOUT, fd, ">&");
+    return r + 2;
+  }
+  lexpush(toks, TOK_OUT, fd, ">");
+  return r + 1;
+}
+
+/*
+ * lexline - Split buf[0..len) into toks, in place. Words are
+ *    unquoted and NUL terminated inside buf, which must have room for
+ *    one byte past len and be readable for LEXPAD bytes past it (the
+ *    scanners read whole blocks; those bytes are not used). Returns the number of tokens, or -1 with
+ *    lexerr set if a quote is not closed.
+ */
+int lexline(char *buf, size_t len, struct tokens_t *toks)
+{
+  char *r = buf, *w = buf, *end = buf + len, *word = NULL, *q;
+  int state = S_GAP, c, fd;
+
+  if (lexclass[' '] != C_SPACE)
+    lexinit();
+  lexmask_build(buf, len);
+  toks->n = 0;
+
+  while (1) {
+    c = (r < end) ? lexclass[(unsigned char)*r] : C_END;
+    switch (lextab[state][c]) {
+      case A_SKIP:
+        r++;
+        break;
+
+      case A_BEGIN:
+        if ((unsigned char)(*r - '0') < 10) {  /* descriptor number before < or > ? */
+          for (q = r, fd = 0; q < end && isdigit((unsigned char)*q) && fd < 1000; q++)
+            fd = fd * 10 + (*q - '0');
+          if (q < end && (*q == '<' || *q == '>')) {
+            r = lexop(q, end, fd, toks);
+            break;
+          }
+        }
+        word = w = r;
+        state = S_WORD;
+        break;
+
+      case A_OP:
+        r = lexop(r, end, -1, toks);
+        break;
+
+      case A_RUN:
+        q = buf + lexrun(buf, r - buf, len, state);
+        if (w != r)
+          memmove(w, r, q - r);
+        w += q - r;
+        r = q;
+        break;
+
+      case A_COPY:
+        *w++ = *r++;
+        break;
+
+      case A_END:
+        *w = '\0';
+        lexpush(toks, TOK_WORD, -1, word);
+        state = S_GAP;
+        if (c == C_END)
+          return toks->n;
+        r++;
+        break;
+
+      case A_ESC:
+        if (r + 1 < end && r[1] == '\n')
+          r += 2;                       /* line continuation */
+        else if (r + 1 < end && lexclass[(unsigned char)r[1]] != C_ORD) {
+          *w++ = r[1];
+          r += 2;
+        }
+        else
+          *w++ = *r++;                  /* not special: keep the backslash */
+        break;
+
+      case A_DQESC:
+        if (r + 1 < end && r[1] == '\n')
+          r += 2;
+        else if (r + 1 < end && strchr("\"\\$`", r[1]) != NULL) {
+          *w++ = r[1];
+          r += 2;
+        }
+        else
+          *w++ = *r++;
+        break;
+
+      case A_SQ:
+        state = (state == S_SQ) ? S_WORD : S_SQ;
+        r++;
+        break;
+
+      case A_DQ:
+        state = (state == S_DQ) ? S_WORD : S_DQ;
+        r++;
+        break;
+
+      case A_DONE:
+        return toks->n;
+
+      case A_ERR:
+        lexerr = (state == S_SQ) ? "unterminated single quote" : "unterminated double quote";
+        return -1;
+    }
+  }
+}
+
+/*
+ * syntax_error - Report a command line that cannot be parsed, with the
+ *    script name and line number when it comes from a script
+ */
+void syntax_error(const char *fmt, ...)
+{
+  va_list ap;
+
+  if (script_name != NULL)
+    out_printf("%s:%d: ", script_name, script_line);
+  out_printf("Syntax error: ");
+  va_start(ap, fmt);
+  out_vprintf(fmt, ap);
+  va_end(ap);
+  out_write("\n", 1);
+}
+
+/*
+ * cmdline_copy - Copy cmdline into cl->buf, leaving the LEXPAD bytes
+ *    lexline needs after it, and return its length
+ */
+static size_t cmdline_copy(const char *cmdline, struct cmdline_t *cl)
+{
+  size_t len = strlen(cmdline);
+
+  if (len + LEXPAD > cl->bufcap) {
+    cl->bufcap = 2 * (len + LEXPAD);
+    if ((cl->buf = realloc(cl->buf, cl->bufcap)) == NULL)
+      unix_error("realloc error");
+  }
+  memcpy(cl->buf, cmdline, len + 1);
+  return len;
+}
+
+/*
+ * cmdline_lex - Split buf[0..len) into cl->toks in place. Returns the
+ *    number of tokens, or -1 after reporting a syntax error.
+ */
+static int cmdline_lex(char *buf, size_t len, struct cmdline_t *cl)
+{
+  int n;
+
+  if ((n = lexline(buf, len, &cl->toks)) < 0)
+    syntax_error("%s", lexerr);
+  return n;
+}
+
+/* cmdline_word - Append word to cl->argv; NULL ends a stage */
+static void cmdline_word(struct cmdline_t *cl, int argc, char *word)
+{
+  if (argc == cl->argvcap) {
+    cl->argvcap = (cl->argvcap == 0) ? 16 : 2 * cl->argvcap;
+    if ((cl->argv = realloc(cl->argv, cl->argvcap * sizeof(char *))) == NULL)
+      unix_error("realloc error");
+  }
+  cl->argv[argc] = word;
+}
+
+/*
+ * parsecmd - Parse cmdline into the stages of a pipeline. Stage i has
+ *    the NULL terminated argument list cl->argv + cl->stage[i].argv and
+ *    the redirections cl->redir + cl->stage[i].redir, all held in cl
+ *    until the next call. Operators other than '|', redirections and a
+ *    final '&' are passed through as words. Returns the number of
+ *    stages, 0 for a blank line, or -1 after reporting a syntax error.
+ */
+int parsecmd(const char *cmdline, struct cmdline_t *cl)
+{
+  size_t len = cmdline_copy(cmdline, cl);
+
+  return parsebuf(cl->buf, len, cl);
+}
+
+/*
+ * parsebuf - Same as parsecmd, but parse buf[0..len) where it is
+ *    rather than a copy. buf must be writable up to buf[len] and
+ *    readable for LEXPAD bytes past that.
+ */
+int parsebuf(char *buf, size_t len, struct cmdline_t *cl)
+{
+  struct token_t *t;
+  int argc, first, nredir, rfirst, i, n;
+
+  cl->nstages = 0;
+  if ((n = cmdline_lex(buf, len, cl)) < 0)
+    return -1;
+  if ((cl->bg = (n > 0 && cl->toks.tok[n-1].type == TOK_BG)) != 0)
+    n--;
+
+  for (argc = first = nredir = rfirst = 0, i = 0; i <= n; i++) {
+    t = &cl->toks.tok[i];
+    if (i < n && t->type >= TOK_IN && t->type <= TOK_DUPOUT) {
+      if (i + 1 == n || t[1].type != TOK_WORD) {
+        syntax_error("missing file name after '%s'", t->text);
+        return -1;
+      }
+      if (t->type == TOK_DUPOUT && strcmp(t[1].text, "-") != 0 &&
+          t[1].text[strspn(t[1].text, "0123456789")] != '\0') {
+        syntax_error("'%s' needs a descriptor number or '-'", t->text);
+        return -1;
+      }
+      if (nredir == cl->redircap) {
+        cl->redircap = (cl->redircap == 0) ? 4 : 2 * cl->redircap;
+        if ((cl->redir = realloc(cl->redir, cl->redircap * sizeof(struct redir_t))) == NULL)
+          unix_error("realloc error");
+      }
+      cl->redir[nredir].type = t->type;
+      cl->redir[nredir].fd = t->fd;
+      cl->redir[nredir++].target = t[1].text;
+      i++;
+      continue;
+    }
+    if (i < n && t->type != TOK_PIPE) {
+      cmdline_word(cl, argc++, t->text);
+      continue;
+    }
+    if (argc == first) {    /* no words since the start or the last '|' */
+      if (n == 0)
+        return 0;           /* blank line */
+      if (i < n)
+        syntax_error("missing command before '|'");
+      else if (cl->nstages > 0)
+        syntax_error("missing command after '|'");
+      else
+        syntax_error("missing command");
+      return -1;
+    }
+    if (cl->nstages == cl->stagecap) {
+      cl->stagecap = (cl->stagecap == 0) ? 4 : 2 * cl->stagecap;
+      if ((cl->stage = realloc(cl->stage, cl->stagecap * sizeof(struct stage_t))) == NULL)
+        unix_error("realloc error");
+    }
+    cl->stage[cl->nstages].argv = first;
+    cl->stage[cl->nstages].redir = rfirst;
+    cl->stage[cl->nstages].nredir = nredir - rfirst;
+    cl->nstages++;
+    cmdline_word(cl, argc++, NULL);
+    first = argc;
+    rfirst = nredir;
+  }
+  return cl->nstages;
+}
+
+/*
+ * parseargs - Parse cmdline into a NULL terminated argv held in
+ *    storage owned by the lexer (valid until the next call), with no
+ *    limit on the line length or the number of arguments. Operators
+ *    other than a final '&' are passed through as words. Returns true
+ *    if the user has requested a BG job (or the line is blank).
+ */
+int parseargs(const char *cmdline, char ***argvp)
+{
+  static struct cmdline_t cl;
+  size_t len = cmdline_copy(cmdline, &cl);
+  int argc, i, n;
+
+  if ((n = cmdline_lex(cl.buf, len, &cl)) < 0)
+    n = 0;
+
+  /* should the job run in the background? */
+  if ((cl.bg = (n > 0 && cl.toks.tok[n-1].type == TOK_BG)) != 0)
+    n--;
+  for (argc = 0, i = 0; i < n; i++)
+    cmdline_word(&cl, argc++, cl.toks.tok[i].text);
+  cmdline_word(&cl, argc, NULL);
+  *argvp = cl.argv;
+
+  if (argc == 0)  /* ignore blank line */
+    return 1;
+  return cl.bg;
+}
 
 /* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.  
+ * parseline - Parse the command line and build the argv array.
+ * 
+ * Kept for callers with a fixed argv[MAXARGS]: same as parseargs, but
+ * copies at most MAXARGS-1 arguments into argv. Return true if the
+ * user has requested a BG job, false if the user has requested a FG
+ * job.  
+ */
+int parseline(const char *cmdline, char **argv) 
+{
+  char **args;
+  int argc, bg;
+
+  bg = parseargs(cmdline, &args);
+  for (argc = 0; args[argc] != NULL && argc < MAXARGS-1; argc++)
+    argv[argc] = args[argc];
+  argv[argc] = NULL;
+  return bg;
+}
+
+/*****************************************************
+ * Builtin commands
+ *
+ * builtins.def is the one place a builtin is registered: its name,
+ * handler, how many arguments it takes and its BI_* flags. mkbuiltins
+ * compiles it into builtins.h, a perfect hash table over the names,
+ * so finding a builtin is one hash, one probe and one strcmp however
+ * many there are. A handler gets argc/argv like main and returns an
+ * exit status; builtin_run has already checked the argument count.
+ * A builtin runs only as a command of its own, not as a pipeline
+ * stage, and a BI_UTIL one only in the foreground. A BI_FORK builtin
+ * is the exception: spawn_job runs it in a fork of the shell, so it
+ * is a job like any program, in the background or in a pipeline.
+ *****************************************************/
+
+#include "builtins.h"
+
+/*
+ * builtin_find - The builtin called name, or NULL if there is none.
+ *    /bin/name and /usr/bin/name find the BI_UTIL builtins.
+ */
+const struct builtin_t *builtin_find(const char *name)
+{
+  const struct builtin_t *b;
+  size_t len;
+  unsigned int h, c;
+  int i, util = 0;
+
+  if (strncmp(name, "/bin/", 5) == 0 || strncmp(name, "/usr/bin/", 9) == 0) {
+    name = strrchr(name, '/') + 1;
+    util = 1;
+  }
+  if ((len = strlen(name)) == 0)
+    return NULL;
+  h = len;
+  for (i = 0; i < BI_NKEYPOS; i++) {
+    c = (bi_keypos[i] < 0) ? (unsigned char)name[len - 1] :
+        (bi_keypos[i] < len) ? (unsigned char)name[bi_keypos[i]] : 0;
+    h += bi_asso[c];
+  }
+  b = &builtins[h & (BI_SLOTS - 1)];
+  if (b->name == NULL || strcmp(b->name, name) != 0 || (util && !(b->flags & BI_UTIL)))
+    return NULL;
+  return b;
+}
+
+/*
+ * builtin_run - Run builtin b with arguments argv, returning its exit
+ *    status, or BI_EXTERNAL if the program is to run instead. A wrong
+ *    number of arguments is reported here, except to a BI_UTIL builtin,
+ *    whose program reports it.
+ */
+int builtin_run(const struct builtin_t *b, char **argv)
+{
+  int argc;
+
+  for (argc = 0; argv[argc] != NULL; argc++)
+    ;
+  if ((argc - 1 < b->minargs || (b->maxargs >= 0 && argc - 1 > b->maxargs)) &&
+      (b->flags & BI_UTIL))
+    return BI_EXTERNAL;
+  if (argc - 1 < b->minargs) {
+    out_printf("%s: missing argument\n", argv[0]);
+    return 2;
+  }
+  if (b->maxargs >= 0 && argc - 1 > b->maxargs) {
+    out_printf("%s: too many arguments\n", argv[0]);
+    return 2;
+  }
+  return b->fn(argc, argv);
+}
+
+/* bi_quit - quit: leave the shell */
+int bi_quit(int argc, char **argv)
+{
+  int i;
+  for(i=0;i<jobs_hwm;i++)
+  {
+    if(jobs[i].state==ST)
+    {//check for stopped jobs and printing them
+      out_printf("[%d] (%d) Stopped", jobs[i].jid, jobs[i].pid);
+    }
+  }
+  exit(0); // closing the shell
+}
+
+/* bi_bgfg - fg and bg: see do_bgfg */
+int bi_bgfg(int argc, char **argv)
+{
+  do_bgfg(argv);
+  return 0;
+}
+
+/* bi_jobs - jobs [-l]: list the jobs, -l with the resources they used */
+int bi_jobs(int argc, char **argv)
+{
+  if(argc>1 && strcmp(argv[1],"-l")==0)
+  {                                 // with the resources used, and the jobs that finished lately
+    listjobs_long(jobs);
+  }
+  else
+  {
+    listjobs(jobs);
+  }
+  return 0;
+}
+
+/* bi_hash - hash: see do_hash */
+int bi_hash(int argc, char **argv)
+{
+  do_hash(argv);
+  return 0;
+}
+
+/* bi_source - source file: run the commands in file */
+int bi_source(int argc, char **argv)
+{
+  if(argc<2)
+  {
+    out_printf("source: filename argument required\n");
+    return 2;
+  }
+  return (source_script(argv[1])<0) ? 1 : 0;
+}
+
+/*
+ * bi_admit - admit [-j N] [-r RATE[/BURST]] [-p CLASS [%jid...]]: set
+ *    the limits on starting background jobs (0 for none), and with -p
+ *    the class (high, normal or low) new jobs are queued in, or that
+ *    the given queued jobs move to. With no arguments, print the
+ *    settings as an admit command.
+ */
+int bi_admit(int argc, char **argv)
+{
+  struct job_t *job;
+  double rate;
+  long n;
+  char *end;
+  int i, c;
+
+  if(argc==1)
+  {
+    out_printf("admit -j %d -r %g/%d -p %s\n",admit_max,admit_rate,admit_burst,qclassname[admit_class]);
+    return 0;
+  }
+  for(i=1;i<argc;i++)
+  {
+    if(strcmp(argv[i],"-j")==0 && i+1<argc)
+    {
+      n=strtol(argv[++i],&end,10);
+      if(*end!='\0' || end==argv[i] || n<0 || n>MAXJOBS)
+      {
+        out_printf("admit: %s: bad number of jobs\n",argv[i]);
+        return 2;
+      }
+      admit_max=n;
+    }
+    else if(strcmp(argv[i],"-r")==0 && i+1<argc)
+    {
+      rate=strtod(argv[++i],&end);
+      n=1;                                      // no bursts unless asked for
+      if(*end=='/')
+      {
+        n=strtol(end+1,&end,10);
+      }
+      if(*end!='\0' || end==argv[i] || !(rate>=0) || n<1 || n>MAXJOBS)
+      {
+        out_printf("admit: %s: bad rate\n",argv[i]);
+        return 2;
+      }
+      admit_rate=rate;
+      admit_burst=n;
+      admit_tokens=n;                           // the bucket starts out full
+      clock_gettime(CLOCK_MONOTONIC,&admit_last);
+    }
+    else if(strcmp(argv[i],"-p")==0 && i+1<argc)
+    {
+      for(c=0;c<NQCLASS && strcmp(argv[i+1],qclassname[c])!=0;c++)
+        ;
+      if(c==NQCLASS)
+      {
+        out_printf("admit: %s: no such class (high, normal or low)\n",argv[i+1]);
+        return 2;
+      }
+      if(++i+1<argc && argv[i+1][0]=='%')
+      {                                         // move queued jobs to the back of class c
+        while(++i<argc)
+        {
+          if((job=getjobjid(jobs,atoi(argv[i]+1)))==NULL || job->state!=QU)
+          {
+            out_printf("%s: No such queued job\n",argv[i]);
+            continue;
+          }
+          admit_dequeue(job);
+          job->qclass=c;
+          admit_enqueue(job);
+        }
+      }
+      else
+      {
+        admit_class=c;
+      }
+    }
+    else
+    {
+      out_printf("usage: admit [-j N] [-r RATE[/BURST]] [-p high|normal|low [%%jid...]]\n");
+      return 2;
+    }
+  }
+  return 0;
+}
+
+/*
+ * bi_affinity - affinity [none | pin CPUS | spread [CPUS] | isolate CPUS]:
+ *    set where processes without an @cpus= prefix run: anywhere, all
+ *    on CPUS, each on the next CPU of CPUS (by default the CPUs the
+ *    shell may use), or anywhere the shell may run but CPUS. With no
+ *    arguments, print the policy as an affinity command.
+ */
+int bi_affinity(int argc, char **argv)
+{
+  static const char *policies[] = { "none", "pin", "spread", "isolate" };
+  cpu_set_t set, shell;
+  char buf[256];
+  int p;
+
+  if(argc==1)
+  {
+    if(aff_policy==AFF_NONE)
+    {
+      out_printf("affinity none\n");
+    }
+    else
+    {
+      out_printf("affinity %s %s\n",policies[aff_policy],cpulist_format(&aff_cpus,buf,sizeof(buf)));
+    }
+    return 0;
+  }
+  for(p=0;p<4 && strcmp(argv[1],policies[p])!=0;p++)
+    ;
+  if(p==4 || (p==AFF_NONE && argc!=2) || (p==AFF_PIN && argc!=3) || (p==AFF_ISOLATE && argc!=3))
+  {
+    out_printf("usage: affinity [none | pin CPUS | spread [CPUS] | isolate CPUS]\n");
+    return 2;
+  }
+  sched_getaffinity(0,sizeof(shell),&shell);
+  set=shell;                                      // spread with no list: over the shell's own CPUs
+  if(argc==3 && cpulist_parse(argv[2],&set)<0)
+  {
+    out_printf("affinity: %s: bad CPU list\n",argv[2]);
+    return 2;
+  }
+  if(p==AFF_ISOLATE)
+  {
+    CPU_XOR(&aff_mask,&shell,&set);
+    CPU_AND(&aff_mask,&aff_mask,&shell);          // the shell's CPUs less the reserved ones
+    if(CPU_COUNT(&aff_mask)==0)
+    {
+      out_printf("affinity: %s: no CPUs would be left\n",argv[2]);
+      return 1;
+    }
+  }
+  else
+  {
+    aff_mask=set;
+  }
+  aff_policy=p;
+  aff_cpus=set;
+  aff_next=0;
+  return 0;
+}
+
+/*
+ * bi_sched - sched [-n N] [-c other|batch|idle] [-i CLASS[/LEVEL]]
+ *    [-b N] [%jid...]: set the nice increment (on the shell's value),
+ *    scheduling policy and I/O priority (rt, be or idle, level 0-7)
+ *    new processes get, or with job IDs, change them for those jobs
+ *    now; "inherit" for -c or -i means the shell's own. -b N makes
+ *    jobs N nice levels lower while they are not in the foreground
+ *    (0 for never). With no arguments, print the defaults.
+ */
+int bi_sched(int argc, char **argv)
+{
+  struct place_t pl;
+  struct job_t *job;
+  char io[16], *end;
+  long n;
+  int i, rc = 0;
+
+  if(argc==1)
+  {
+    out_printf("sched -n %d -c %s -i %s -b %d\n",sched_nice,(sched_policy>=0) ? policyname[sched_policy] : "inherit",
+               (sched_ioprio>=0) ? ioprio_format(sched_ioprio,io,sizeof(io)) : "inherit",sched_boost);
+    return 0;
+  }
+  pl.set=0;
+  for(i=1;i<argc && argv[i][0]=='-';i+=2)
+  {
+    if(i+1==argc || strlen(argv[i])!=2 || strchr("ncib",argv[i][1])==NULL)
+    {
+      out_printf("usage: sched [-n N] [-c other|batch|idle] [-i CLASS[/LEVEL]] [-b N] [%%jid...]\n");
+      return 2;
+    }
+    if(argv[i][1]=='n' || argv[i][1]=='b')
+    {
+      n=strtol(argv[i+1],&end,10);
+      if(*end!='\0' || end==argv[i+1] || n<((argv[i][1]=='b') ? 0 : -39) || n>39)
+      {
+        out_printf("sched: %s: bad nice increment\n",argv[i+1]);
+        return 2;
+      }
+      if(argv[i][1]=='b')
+      {
+        sched_boost=n;                            // jobs out of the foreground keep the penalty they have
+      }
+      else
+      {
+        pl.nice=n;
+        pl.set|=PL_NICE;
+      }
+    }
+    else if(argv[i][1]=='c')
+    {
+      if((pl.policy=policy_parse(argv[i+1]))<0 && strcmp(argv[i+1],"inherit")!=0)
+      {
+        out_printf("sched: %s: no such policy (other, batch or idle)\n",argv[i+1]);
+        return 2;
+      }
+      pl.set|=PL_SCHED;
+    }
+    else
+    {
+      if((pl.ioprio=ioprio_parse(argv[i+1]))<0 && strcmp(argv[i+1],"inherit")!=0)
+      {
+        out_printf("sched: %s: bad I/O priority\n",argv[i+1]);
+        return 2;
+      }
+      pl.set|=PL_IO;
+    }
+  }
+  if(i==argc)
+  {                                               // defaults for new processes
+    if(pl.set&PL_NICE)
+    {
+      sched_nice=pl.nice;
+    }
+    if(pl.set&PL_SCHED)
+    {
+      sched_policy=pl.policy;
+    }
+    if(pl.set&PL_IO)
+    {
+      sched_ioprio=pl.ioprio;
+    }
+    return 0;
+  }
+  if((pl.set&PL_SCHED) && pl.policy<0)
+  {
+    pl.policy=sched_getscheduler(0)&~SCHED_RESET_ON_FORK;
+  }
+  if((pl.set&PL_IO) && pl.ioprio<0)
+  {
+    pl.ioprio=syscall(SYS_ioprio_get,IOPRIO_WHO_PROCESS,0);
+  }
+  for(;i<argc;i++)
+  {
+    if(argv[i][0]!='%' || (job=getjobjid(jobs,atoi(argv[i]+1)))==NULL || job->state==QU)
+    {
+      out_printf("%s: No such job\n",argv[i]);
+      rc=1;
+    }
+    else if(job_place(job,&pl)<0)
+    {
+      out_printf("%s: %s\n",argv[i],strerror(errno));
+      rc=1;
+    }
+  }
+  return rc;
+}
+
+/*
+ * bi_history - history [N | -s STRING | -c | -f FILE]: list the last N
+ *    lines of the history (all of it by default) with their numbers,
+ *    list the distinct lines containing STRING, clear the history, or
+ *    move to the history file FILE.
+ */
+int bi_history(int argc, char **argv)
+{
+  char *end;
+  long n = -1;
+
+  if(argc==3 && strcmp(argv[1],"-f")==0)
+  {
+    if(hist_open(argv[2])<0)
+    {
+      out_printf("history: %s: cannot be used as a history file\n",argv[2]);
+      return 1;
+    }
+    return 0;
+  }
+  if(argc==3 && strcmp(argv[1],"-s")==0)
+  {
+    hist_init();
+    return hist!=NULL ? hist_search(argv[2]) : 1;
+  }
+  if(argc==2 && strcmp(argv[1],"-c")==0)
+  {
+    hist_init();
+    if(hist!=NULL)
+    {
+      hist_clear();
+    }
+    return 0;
+  }
+  if(argc==2 && ((n=strtol(argv[1],&end,10))<0 || *end!='\0' || end==argv[1]))
+  {
+    n=-2;
+  }
+  if(argc>2 || n==-2)
+  {
+    out_printf("usage: history [N | -s STRING | -c | -f FILE]\n");
+    return 2;
+  }
+  hist_init();
+  if(hist!=NULL)
+  {
+    hist_list((n<0) ? UINT64_MAX : (uint64_t)n);
+  }
+  return 0;
+}
+
+/*
+ * bi_compgen - compgen [-c | -f] [WORD...]: print the completions of
+ *    the last WORD, one per line. It is taken as a command name if it
+ *    is the first WORD and has no '/', and as a file name otherwise;
+ *    -c and -f say which. Exits 1 if there are none.
+ */
+int bi_compgen(int argc, char **argv)
+{
+  int i=1, kind=0, n;
+  const char *word;
+
+  if(argc>1 && (strcmp(argv[1],"-c")==0 || strcmp(argv[1],"-f")==0))
+  {
+    kind=argv[1][1];
+    i++;
+  }
+  else if(argc>1 && argv[1][0]=='-' && argv[1][1]!='\0')
+  {
+    out_printf("usage: compgen [-c | -f] [WORD...]\n");
+    return 2;
+  }
+  word=(i<argc) ? argv[argc-1] : "";
+  if(kind==0)
+  {
+    kind=(argc-i<=1 && strchr(word,'/')==NULL) ? 'c' : 'f';   // the command word, or an argument
+  }
+  n=(kind=='c') ? comp_commands(word) : comp_files(word);
+  return n==0;
+}
+
+/*****************************************************
+ * Standard utilities run in the shell: echo, printf, true, false,
+ * test and [. They write through the output buffer and match the
+ * GNU coreutils programs byte for byte, and so also stand in for
+ * /bin/<name> and /usr/bin/<name> (BI_UTIL). Anything they do not
+ * handle the same way (--help, \u escapes, %q, arguments the program
+ * would complain about) makes them return BI_EXTERNAL before any
+ * output, and the program is run instead.
+ *****************************************************/
+
+/* is_help - True for a lone --help or --version, which the programs answer */
+static int is_help(int argc, char **argv)
+{
+  return argc == 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "--version") == 0);
+}
+
+/* isodigit - True for an octal digit */
+static int isodigit(int c)
+{
+  return c >= '0' && c <= '7';
+}
+
+/* hexval - Value of the hex digit c */
+static int hexval(int c)
+{
+  return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+/*
+ * echo_escape - Write s with echo -e's escapes expanded. Returns 1 if
+ *    it held \c, which ends all output.
+ */
+static int echo_escape(const char *s)
+{
+  char c;
+
+  while ((c = *s++) != '\0') {
+    if (c != '\\' || *s == '\0') {
+      out_write(&c, 1);
+      continue;
+    }
+    switch (c = *s++) {
+      case 'a': c = '\a'; break;
+      case 'b': c = '\b'; break;
+      case 'c': return 1;
+      case 'e': c = '\x1B'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'v': c = '\v'; break;
+      case '\\': break;
+      case 'x':
+        if (!isxdigit((unsigned char)*s)) {
+          out_write("\\", 1);
+          break;
+        }
+        c = hexval((unsigned char)*s++);
+        if (isxdigit((unsigned char)*s))
+          c = c * 16 + hexval((unsigned char)*s++);
+        break;
+      case '0':                  /* \0 and up to three more octal digits */
+        c = 0;
+        if (!isodigit(*s))
+          break;
+        c = *s++;
+        /* FALLTHROUGH */
+      case '1': case '2': case '3': case '4': case '5': case '6': case '7':
+        c -= '0';                /* up to three octal digits in all */
+        if (isodigit(*s))
+          c = c * 8 + (*s++ - '0');
+        if (isodigit(*s))
+          c = c * 8 + (*s++ - '0');
+        break;
+      default:                   /* not an escape: keep the backslash */
+        out_write("\\", 1);
+        break;
+    }
+    out_write(&c, 1);
+  }
+  return 0;
+}
+
+/* bi_echo - echo [-neE] [string ...] */
+int bi_echo(int argc, char **argv)
+{
+  int i, nl = 1, esc = 0;
+  char *p;
+
+  if (is_help(argc, argv))
+    return BI_EXTERNAL;
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0' &&
+       strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); i++)
+    for (p = argv[i] + 1; *p != '\0'; p++) {   /* an option only if all of it is */
+      if (*p == 'n')
+        nl = 0;
+      else
+        esc = (*p == 'e');
+    }
+  for (; i < argc; i++) {
+    if (!esc)
+      out_write(argv[i], strlen(argv[i]));
+    else if (echo_escape(argv[i]))
+      return 0;
+    if (i + 1 < argc)
+      out_write(" ", 1);
+  }
+  if (nl)
+    out_write("\n", 1);
+  return 0;
+}
+
+/*
+ * printf_escape - Write the escape at *sp (just past a backslash) to
+ *    fp and advance *sp past it. octal0 is %b's form, \0ooo, rather
+ *    than the format's \ooo. Returns 1 for \c, 0 otherwise, or -1 for
+ *    an escape to leave to the program.
+ */
+static int printf_escape(FILE *fp, const char **sp, int octal0)
+{
+  const char *p = *sp;
+  int c = 0, n;
+
+  if (*p == 'x') {
+    if (!isxdigit((unsigned char)*++p))
+      return -1;
+    for (n = 0; n < 2 && isxdigit((unsigned char)*p); n++)
+      c = c * 16 + hexval((unsigned char)*p++);
+  }
+  else if (isodigit(*p)) {
+    if (octal0 && *p == '0')
+      p++;
+    for (n = 0; n < 3 && isodigit(*p); n++)
+      c = c * 8 + (*p++ - '0');
+  }
+  else if (*p != '\0' && strchr("\"\\abcefnrtv", *p) != NULL) {
+    switch (c = *p++) {
+      case 'a': c = '\a'; break;
+      case 'b': c = '\b'; break;
+      case 'c': return 1;
+      case 'e': c = '\x1B'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'v': c = '\v'; break;
+    }
+  }
+  else if (*p == 'u' || *p == 'U')
+    return -1;                   /* a character in the locale's encoding */
+  else {
+    putc('\\', fp);
+    if (*p == '\0')
+      return 0;
+    c = *p++;
+  }
+  putc(c, fp);
+  *sp = p;
+  return 0;
+}
+
+/*
+ * printf_num - Parse a numeric argument as printf(1) does: a leading '
+ *    or " gives the code of the next character. Returns -1 if it would
+ *    complain about the argument.
+ */
+static int printf_num(const char *arg, intmax_t *ip, uintmax_t *up, long double *fp, int conv)
+{
+  char *end;
+
+  if (arg[0] == '\'' || arg[0] == '"') {
+    if (arg[1] == '\0' || arg[2] != '\0' || (unsigned char)arg[1] >= 0x80)
+      return -1;                 /* the program warns about the rest */
+    *ip = *up = (unsigned char)arg[1];
+    *fp = (unsigned char)arg[1];
+    return 0;
+  }
+  errno = 0;
+  if (strchr("di", conv) != NULL)
+    *ip = strtoimax(arg, &end, 0);
+  else if (strchr("ouxX", conv) != NULL)
+    *up = strtoumax(arg, &end, 0);
+  else
+    *fp = strtold(arg, &end);
+  return (errno != 0 || end == arg || *end != '\0') ? -1 : 0;
+}
+
+/*
+ * printf_fmt - One pass of printf's format over argv from *ai, into fp.
+ *    Returns 1 if \c ended the output, -1 to leave the command to the
+ *    program, 0 otherwise.
+ */
+static int printf_fmt(FILE *fp, const char *f, char **argv, int argc, int *ai)
+{
+  char spec[64], *sp, conv;
+  const char *arg, *p;
+  intmax_t iv;
+  uintmax_t uv;
+  long double fv;
+  int w, prec, nstar, star[2], rc;
+
+  while (*f != '\0') {
+    if (*f == '\\') {
+      f++;
+      if ((rc = printf_escape(fp, &f, 0)) != 0)
+        return rc;
+      continue;
+    }
+    if (*f != '%') {
+      putc(*f++, fp);
+      continue;
+    }
+    if (*++f == '%') {
+      putc(*f++, fp);
+      continue;
+    }
+
+    /* [flags][width][.precision][length]conversion, * taking an argument */
+    sp = spec;
+    *sp++ = '%';
+    nstar = 0;
+    while (*f != '\0' && strchr("-+ #0'", *f) != NULL && sp < spec + 16)
+      *sp++ = *f++;
+    for (w = 0; w < 2; w++) {
+      if (w == 1) {
+        if (*f != '.')
+          break;
+        *sp++ = *f++;
+      }
+      if (*f == '*') {
+        *sp++ = *f++;
+        arg = (*ai < argc) ? argv[(*ai)++] : "0";
+        if (printf_num(arg, &iv, &uv, &fv, 'd') < 0 || iv < INT_MIN || iv > INT_MAX)
+          return -1;
+        star[nstar++] = iv;
+      }
+      else
+        while (isdigit((unsigned char)*f)) {
+          if (sp >= spec + 40)
+            return -1;
+          *sp++ = *f++;
+        }
+    }
+    while (*f != '\0' && strchr("hlLjzt", *f) != NULL)
+      f++;                       /* length modifiers are ignored */
+    if ((conv = *f++) == '\0' || strchr("diouxXfFeEgGaAcsb", conv) == NULL)
+      return -1;                 /* %q, or a bad conversion */
+
+    arg = (*ai < argc) ? argv[(*ai)++] : NULL;
+    w = (nstar > 0) ? star[0] : 0;
+    prec = (nstar > 1) ? star[1] : 0;
+    if (conv == 'b') {
+      for (p = (arg != NULL) ? arg : ""; *p != '\0'; ) {
+        if (*p++ != '\\') {
+          putc(p[-1], fp);
+          continue;
+        }
+        if ((rc = printf_escape(fp, &p, 1)) != 0)
+          return rc;
+      }
+      continue;
+    }
+    if (strchr("diouxX", conv) != NULL) {
+      strcpy(sp, "j");
+      sp++;
+    }
+    else if (conv != 'c' && conv != 's') {
+      strcpy(sp, "L");
+      sp++;
+    }
+    sp[0] = conv;
+    sp[1] = '\0';
+    iv = 0;
+    uv = 0;
+    fv = 0;
+    if (strchr("cs", conv) == NULL && arg != NULL && printf_num(arg, &iv, &uv, &fv, conv) < 0)
+      return -1;
+    if (arg == NULL)
+      arg = "";
+    switch (conv) {
+      case 'd': case 'i':
+        rc = (nstar == 2) ? fprintf(fp, spec, w, prec, iv) :
+             (nstar == 1) ? fprintf(fp, spec, w, iv) : fprintf(fp, spec, iv);
+        break;
+      case 'o': case 'u': case 'x': case 'X':
+        rc = (nstar == 2) ? fprintf(fp, spec, w, prec, uv) :
+             (nstar == 1) ? fprintf(fp, spec, w, uv) : fprintf(fp, spec, uv);
+        break;
+      case 'c':
+        rc = (nstar == 2) ? fprintf(fp, spec, w, prec, arg[0]) :
+             (nstar == 1) ? fprintf(fp, spec, w, arg[0]) : fprintf(fp, spec, arg[0]);
+        break;
+      case 's':
+        rc = (nstar == 2) ? fprintf(fp, spec, w, prec, arg) :
+             (nstar == 1) ? fprintf(fp, spec, w, arg) : fprintf(fp, spec, arg);
+        break;
+      default:
+        rc = (nstar == 2) ? fprintf(fp, spec, w, prec, fv) :
+             (nstar == 1) ? fprintf(fp, spec, w, fv) : fprintf(fp, spec, fv);
+    }
+    if (rc < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * bi_printf - printf format [argument ...]. The format is used again
+ *    while arguments are left. The output is built in memory first so
+ *    the command can still be left to the program.
+ */
+int bi_printf(int argc, char **argv)
+{
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *fp;
+  int ai = 2, start, rc;
+
+  if (is_help(argc, argv) || strcmp(argv[1], "--") == 0)
+    return BI_EXTERNAL;
+  if ((fp = open_memstream(&buf, &len)) == NULL)
+    unix_error("open_memstream error");
+  do {
+    start = ai;
+    rc = printf_fmt(fp, argv[1], argv, argc, &ai);
+  } while (rc == 0 && ai < argc && ai > start);
+  if (rc == 0 && ai < argc)
+    rc = -1;                     /* the program warns about the arguments left over */
+  fclose(fp);
+  if (rc >= 0)
+    out_write(buf, len);
+  free(buf);
+  return (rc < 0) ? BI_EXTERNAL : 0;
+}
+
+/* bi_true - true: exit status 0 */
+int bi_true(int argc, char **argv)
+{
+  return is_help(argc, argv) ? BI_EXTERNAL : 0;
+}
+
+/* bi_false - false: exit status 1 */
+int bi_false(int argc, char **argv)
+{
+  return is_help(argc, argv) ? BI_EXTERNAL : 1;
+}
+
+/* bi_colon - : does nothing, whatever its arguments */
+int bi_colon(int argc, char **argv)
+{
+  return 0;
+}
+
+/* test_int - Parse an integer operand of test, blanks allowed around it */
+static int test_int(const char *s, intmax_t *v)
+{
+  char *end;
+
+  errno = 0;
+  *v = strtoimax(s, &end, 10);
+  if (end == s || errno != 0 || !(isdigit((unsigned char)end[-1])))
+    return -1;
+  while (isspace((unsigned char)*end))
+    end++;
+  return (*end == '\0') ? 0 : -1;
+}
+
+/* test_unary - True if op is one of test's unary operators */
+static int test_unary(const char *op)
+{
+  return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+         strchr("bcdefgGhkLNOprsStuwxnz", op[1]) != NULL;
+}
+
+/* test_binary - True if op is one of test's binary operators */
+static int test_binary(const char *op)
+{
+  static const char *ops[] = { "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt",
+                               "-ge", "-nt", "-ot", "-ef", NULL };
+  int i;
+
+  for (i = 0; ops[i] != NULL; i++)
+    if (strcmp(op, ops[i]) == 0)
+      return 1;
+  return 0;
+}
+
+/* test_do_unary - Evaluate op arg: 1, 0, or -1 for an error */
+static int test_do_unary(const char *op, const char *arg)
+{
+  struct stat st;
+  intmax_t fd;
+
+  switch (op[1]) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 't':
+      if (test_int(arg, &fd) < 0 || fd < INT_MIN || fd > INT_MAX)
+        return -1;
+      return isatty(fd);
+    case 'h': case 'L':
+      return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    case 'r': return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+    case 'w': return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+    case 'x': return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+  }
+  if (stat(arg, &st) != 0)
+    return 0;
+  switch (op[1]) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'G': return st.st_gid == getegid();
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 'N': return st.st_mtim.tv_sec > st.st_atim.tv_sec ||
+                     (st.st_mtim.tv_sec == st.st_atim.tv_sec && st.st_mtim.tv_nsec > st.st_atim.tv_nsec);
+    case 'O': return st.st_uid == geteuid();
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+  }
+  return -1;
+}
+
+/* mtime_cmp - Compare the modification times of two stat results */
+static int mtime_cmp(struct stat *a, struct stat *b)
+{
+  if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+    return (a->st_mtim.tv_sec < b->st_mtim.tv_sec) ? -1 : 1;
+  if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)
+    return (a->st_mtim.tv_nsec < b->st_mtim.tv_nsec) ? -1 : 1;
+  return 0;
+}
+
+/* test_do_binary - Evaluate a op b: 1, 0, or -1 for an error */
+static int test_do_binary(const char *a, const char *op, const char *b)
+{
+  struct stat sa, sb;
+  intmax_t x, y;
+  int oka, okb;
+
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+    return strcmp(a, b) == 0;
+  if (strcmp(op, "!=") == 0)
+    return strcmp(a, b) != 0;
+  if (op[1] == 'n' && op[2] == 't') {
+    oka = stat(a, &sa) == 0;
+    okb = stat(b, &sb) == 0;
+    return oka && (!okb || mtime_cmp(&sa, &sb) > 0);
+  }
+  if (op[1] == 'o' && op[2] == 't') {
+    oka = stat(a, &sa) == 0;
+    okb = stat(b, &sb) == 0;
+    return okb && (!oka || mtime_cmp(&sa, &sb) < 0);
+  }
+  if (strcmp(op, "-ef") == 0)
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+           sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+  if (test_int(a, &x) < 0 || test_int(b, &y) < 0)
+    return -1;                   /* not an integer, or too big for intmax_t */
+  switch (op[1] * 256 + op[2]) {
+    case 'e' * 256 + 'q': return x == y;
+    case 'n' * 256 + 'e': return x != y;
+    case 'l' * 256 + 't': return x < y;
+    case 'l' * 256 + 'e': return x <= y;
+    case 'g' * 256 + 't': return x > y;
+  }
+  return x >= y;
+}
+
+static int test_or(char **argv, int *i, int n);
+
+/* test_term - term: ! term | ( expr ) | unary operand | a binary b | string */
+static int test_term(char **argv, int *i, int n)
+{
+  int r;
+
+  if (*i >= n)
+    return -1;
+  if (strcmp(argv[*i], "!") == 0) {
+    (*i)++;
+    return ((r = test_term(argv, i, n)) < 0) ? -1 : !r;
+  }
+  if (strcmp(argv[*i], "(") == 0) {
+    (*i)++;
+    if ((r = test_or(argv, i, n)) < 0 || *i >= n || strcmp(argv[*i], ")") != 0)
+      return -1;
+    (*i)++;
+    return r;
+  }
+  if (*i + 2 < n && test_binary(argv[*i + 1])) {
+    *i += 3;
+    return test_do_binary(argv[*i - 3], argv[*i - 2], argv[*i - 1]);
+  }
+  if (test_unary(argv[*i]) && *i + 1 < n) {
+    *i += 2;
+    return test_do_unary(argv[*i - 2], argv[*i - 1]);
+  }
+  return argv[(*i)++][0] != '\0';
+}
+
+/* test_and - and: term [-a term ...] */
+static int test_and(char **argv, int *i, int n)
+{
+  int r, s;
+
+  if ((r = test_term(argv, i, n)) < 0)
+    return -1;
+  while (*i < n && strcmp(argv[*i], "-a") == 0) {
+    (*i)++;
+    if ((s = test_term(argv, i, n)) < 0)
+      return -1;
+    r = r && s;
+  }
+  return r;
+}
+
+/* test_or - expr: and [-o and ...] */
+static int test_or(char **argv, int *i, int n)
+{
+  int r, s;
+
+  if ((r = test_and(argv, i, n)) < 0)
+    return -1;
+  while (*i < n && strcmp(argv[*i], "-o") == 0) {
+    (*i)++;
+    if ((s = test_and(argv, i, n)) < 0)
+      return -1;
+    r = r || s;
+  }
+  return r;
+}
+
+/*
+ * test_eval - Evaluate the n operands of test: POSIX's rules by
+ *    operand count up to four, then the -a/-o grammar. Returns 1 for
+ *    true, 0 for false, -1 for anything test would report as an error.
+ */
+static int test_eval(char **argv, int n)
+{
+  int i = 0, r;
+
+  switch (n) {
+    case 0:
+      return 0;
+    case 1:
+      return argv[0][0] != '\0';
+    case 2:
+      if (strcmp(argv[0], "!") == 0)
+        return argv[1][0] == '\0';
+      if (test_unary(argv[0]))
+        return test_do_unary(argv[0], argv[1]);
+      return -1;
+    case 3:
+      if (test_binary(argv[1]))
+        return test_do_binary(argv[0], argv[1], argv[2]);
+      if (strcmp(argv[0], "!") == 0)
+        return ((r = test_eval(argv + 1, 2)) < 0) ? -1 : !r;
+      if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0)
+        return argv[1][0] != '\0';
+      break;
+    case 4:
+      if (strcmp(argv[0], "!") == 0)
+        return ((r = test_eval(argv + 1, 3)) < 0) ? -1 : !r;
+      if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0)
+        return test_eval(argv + 1, 2);
+      break;
+  }
+  r = test_or(argv, &i, n);
+  return (i == n) ? r : -1;
+}
+
+/* bi_test - test expression, and [ expression ] */
+int bi_test(int argc, char **argv)
+{
+  int r;
+
+  if (strcmp(argv[0] + strlen(argv[0]) - 1, "[") == 0) {
+    if (is_help(argc, argv) || strcmp(argv[argc - 1], "]") != 0)
+      return BI_EXTERNAL;
+    argc--;
+  }
+  if ((r = test_eval(argv + 1, argc - 1)) < 0)
+    return BI_EXTERNAL;          /* the program prints the error */
+  return !r;
+}
+
+/*****************************************************
+ * parallel: run a command once per argument, N at a time
+ *
+ * parallel [-j N] [-k|--keep-order] [--summary] command [word...]
+ *     [::: arg...]
+ * Each argument replaces every {} in the words of the command, or is
+ * added as a last word if there is no {}. The arguments come after
+ * :::, or else one per line from standard input. At most N tasks run
+ * at once (default: the number of online CPUs), each started as soon
+ * as a slot frees up, with /dev/null as input. With -k the output of
+ * each task is held in a memfd and written out in argument order;
+ * otherwise tasks write as they go. --summary lists how every task
+ * ended. The exit status is the number of tasks that failed, up to
+ * PARFAILMAX.
+ *
+ * parallel is a BI_FORK builtin, so the process running it is the
+ * job PID and process group of one job, and every task is started
+ * into that group. ctrl-c, ctrl-z, fg and bg thus act on the whole
+ * batch, and the job's usage in jobs -l covers all of its tasks.
+ *****************************************************/
+
+/* par_usage - Report a bad parallel command line */
+static int par_usage(const char *why)
+{
+  out_printf("parallel: %s\n", why);
+  out_printf("usage: parallel [-j N] [-k|--keep-order] [--summary] command [word...] [::: arg...]\n");
+  return 2;
+}
+
+/* par_stdin_args - Read the arguments from standard input, one per line */
+static char **par_stdin_args(int *np)
+{
+  char **args = NULL, *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  int n = 0, max = 0;
+
+  while ((len = getline(&line, &cap, stdin)) >= 0) {
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (n == max) {
+      max = (max == 0) ? 64 : 2 * max;
+      if ((args = realloc(args, max * sizeof(char *))) == NULL)
+        unix_error("realloc error");
+    }
+    if ((args[n++] = strdup(line)) == NULL)
+      unix_error("strdup error");
+  }
+  free(line);
+  *np = n;
+  return args;
+}
+
+/*
+ * par_subst - Copy word with every {} replaced by arg. Returns NULL
+ *    if word has no {} in it.
+ */
+static char *par_subst(const char *word, const char *arg)
+{
+  const char *p, *q;
+  char *s;
+  size_t n = 0, alen = strlen(arg);
+
+  if (strstr(word, "{}") == NULL)
+    return NULL;
+  for (p = word; (q = strstr(p, "{}")) != NULL; p = q + 2)
+    n += (q - p) + alen;
+  n += strlen(p);
+  if ((s = malloc(n + 1)) == NULL)
+    unix_error("malloc error");
+  for (n = 0, p = word; (q = strstr(p, "{}")) != NULL; p = q + 2) {
+    memcpy(s + n, p, q - p);
+    memcpy(s + n + (q - p), arg, alen);
+    n += (q - p) + alen;
+  }
+  strcpy(s + n, p);
+  return s;
+}
+
+/*
+ * par_start - Start task t: the ncmd words at cmd with its argument
+ *    put in, input from devnull, and output to a new memfd if keep is
+ *    set. A command that cannot be run is reported and the task ends
+ *    with exit status 127 without being started.
+ */
+static void par_start(struct task_t *t, char **cmd, int ncmd, int devnull, int keep)
+{
+  posix_spawn_file_actions_t acts;
+  char **argv, *path;
+  int i, fd, err, subst = 0;
+
+  if ((argv = malloc((ncmd + 2) * sizeof(char *))) == NULL)
+    unix_error("malloc error");
+  for (i = 0; i < ncmd; i++) {
+    if ((argv[i] = par_subst(cmd[i], t->arg)) != NULL)
+      subst = 1;
+    else
+      argv[i] = cmd[i];
+  }
+  if (!subst)
+    argv[ncmd++] = t->arg;
+  argv[ncmd] = NULL;
+
+  t->status = -1;
+  if ((path = resolve_cmd(argv[0], &fd)) == NULL) {
+    out_printf("%s: Command not found\n", argv[0]);
+    t->status = 127 << 8;
+  }
+  else {
+    posix_spawn_file_actions_init(&acts);
+    posix_spawn_file_actions_adddup2(&acts, devnull, STDIN_FILENO);
+    if (keep) {
+      if ((t->out = memfd_create("parallel", MFD_CLOEXEC)) < 0)
+        unix_error("memfd_create error");
+      posix_spawn_file_actions_adddup2(&acts, t->out, STDOUT_FILENO);
+    }
+    out_flush();   /* what parallel printed so far goes before the task's output */
+    if ((err = posix_spawn(&t->pid, path, &acts, NULL, argv, environ)) != 0) {
+      out_printf("%s: %s\n", argv[0], strerror(err));
+      t->status = 127 << 8;
+    }
+    posix_spawn_file_actions_destroy(&acts);
+  }
+
+  for (i = 0; i < ncmd; i++)
+    if (argv[i] != cmd[i] && argv[i] != t->arg)
+      free(argv[i]);
+  free(argv);
+}
+
+/* par_emit - Write out what task t (run with -k) printed */
+static void par_emit(struct task_t *t)
+{
+  char buf[PARCOPY];
+  ssize_t n;
+  off_t off = 0;
+
+  if (t->out < 0)
+    return;
+  while ((n = pread(t->out, buf, sizeof(buf), off)) > 0) {
+    out_write(buf, n);
+    off += n;
+  }
+  close(t->out);
+  t->out = -1;
+}
+
+/* bi_parallel - parallel: see above */
+int bi_parallel(int argc, char **argv)
+{
+  struct task_t *tasks;
+  char **args, *num, *end;
+  int *slots;      /* index in tasks of the task in each worker slot, -1 if free */
+  int i, cmd, ncmd, nargs, njobs = 0, keep = 0, summary = 0;
+  int next, emitted, running, failed, devnull, status;
+  pid_t pid;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--keep-order") == 0)
+      keep = 1;
+    else if (strcmp(argv[i], "--summary") == 0)
+      summary = 1;
+    else if (strncmp(argv[i], "-j", 2) == 0) {
+      num = (argv[i][2] != '\0') ? argv[i] + 2 : argv[++i];   /* -jN or -j N */
+      if (num == NULL || (njobs = strtol(num, &end, 10)) < 1 || *end != '\0')
+        return par_usage("-j needs a number of jobs");
+    }
+    else
+      return par_usage("unknown option");
+  }
+  for (cmd = i; i < argc && strcmp(argv[i], ":::") != 0; i++)
+    ;
+  if ((ncmd = i - cmd) == 0)
+    return par_usage("missing command");
+  if (i < argc) {
+    args = argv + i + 1;
+    nargs = argc - i - 1;
+  }
+  else
+    args = par_stdin_args(&nargs);
+  if (njobs == 0 && (njobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+    njobs = 1;
+  if (njobs > nargs)
+    njobs = (nargs > 0) ? nargs : 1;
+
+  if ((tasks = calloc(nargs + 1, sizeof(struct task_t))) == NULL ||
+      (slots = malloc(njobs * sizeof(int))) == NULL)
+    unix_error("malloc error");
+  for (i = 0; i < nargs; i++) {
+    tasks[i].arg = args[i];
+    tasks[i].out = -1;
+  }
+  for (i = 0; i < njobs; i++)
+    slots[i] = -1;
+  if ((devnull = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+    unix_error("open /dev/null error");
+
+  next = emitted = running = 0;
+  while (next < nargs || running > 0) {
+    for (i = 0; i < njobs && next < nargs; i++) {
+      if (slots[i] >= 0)
+        continue;
+      par_start(&tasks[next], argv + cmd, ncmd, devnull, keep);
+      if (tasks[next].status < 0) {
+        slots[i] = next;
+        running++;
+      }
+      next++;
+    }
+    if (running > 0) {
+      if ((pid = waitpid(-1, &status, 0)) < 0) {
+        if (errno == EINTR)
+          continue;
+        unix_error("waitpid error");
+      }
+      for (i = 0; i < njobs; i++) {
+        if (slots[i] >= 0 && tasks[slots[i]].pid == pid) {
+          tasks[slots[i]].status = status;
+          slots[i] = -1;
+          running--;
+        }
+      }
+    }
+    while (keep && emitted < next && tasks[emitted].status >= 0)
+      par_emit(&tasks[emitted++]);
+  }
+
+  failed = 0;
+  for (i = 0; i < nargs; i++)
+    if (tasks[i].status != 0)
+      failed++;
+  if (summary) {
+    for (i = 0; i < nargs; i++) {
+      status = tasks[i].status;
+      if (WIFSIGNALED(status))
+        out_printf("[%d] %s: terminated by signal %d\n", i + 1, tasks[i].arg, WTERMSIG(status));
+      else
+        out_printf("[%d] %s: exit %d\n", i + 1, tasks[i].arg, WEXITSTATUS(status));
+    }
+    out_printf("parallel: %d tasks, %d failed\n", nargs, failed);
+  }
+  return (failed < PARFAILMAX) ? failed : PARFAILMAX;
+}
+
+/* 
+ * do_bgfg - Execute the builtin bg and fg commands
+ */
+void do_bgfg(char **argv) 
+{
+  int jid=0;
+  struct job_t *job_det=NULL;
+  
+    if(argv[1]==NULL)
+    { // if we dont have anything written as input after fg or bg then its null and thus to print this
+      out_printf("%s command requires PID or %% jobid argument\n",argv[0]);
+      return;
+    }
+    else//if something is written after fg or bg
+    { 
+      if((argv[1][0]=='%'))//if first character of second argumeng is %
+      {                                                         
+
+        jid=atoi(&argv[1][1]); //getting job id which will be the second character of the second argument
+        job_det=getjobjid(jobs,jid); 
+        // getting the job details from the given jobid
+        if(job_det==NULL)
+        {                                                          
+          out_printf("%%%d: No such job\n",jid);                                      
+          return;
+        }
+      }        
+      else if(argv[1][0]>=48 && argv[1][0]<=57) // if second argument starts with a digit ie checking if it is a process id or not
+      {                                        
+        jid=atoi(&argv[1][0]);     // getting the process id from second argument 
+        job_det= getjobpid(jobs,jid);    
+        // getting the job details from the given process id
+        if(job_det==NULL)
+        {                                                            
+          out_printf("(%d): No such process\n",jid);                                   
+          return;                      
+        }
+      } 
+    
+      else//if second arguments first character neither a % nor a digit the it aint valid
+      { 
+        out_printf("%s command requires PID or %% jobid\n",argv[0]);            
+        return;                
+      }
+
+      if(job_det->state==QU && !admit_start(job_det))
+      {                                // a queued job is started now, whatever the admission limits
+        return;
+      }
+                  
+      if(strcmp(argv[0],"fg")==0)
+      {
+        sched_promote(job_det);      // before it runs again, so it wakes up with its own priority
+      }
+      else
+      {
+        sched_demote(job_det);
+      }
+      job_kill(job_det,SIGCONT);     //continuing the stopped execution
+
+      if(strcmp(argv[0],"fg")==0)  //for foregroung
+      {
+        setjobstate(job_det,FG);
+         //making state of foreground jobs to FG
+        waitfg(job_det->pid); //waiting for foreground job to terminate
+      }
+      else // for backgroung
+      {
+        setjobstate(job_det,BG);
+        //making state of background jobs to BG
+
+        out_printf("[%d] (%d) %s",job_det->jid,job_det->pid,jobcmd(job_det));                                      
+      }    
+    }    
+                 
+  return;
+}                    
+/*
+ * waitfg - Block until process pid is no longer the foreground process
+ */
+void waitfg(pid_t pid)
+{
+  sigset_t mask, prev, wait_mask;
+  struct timespec ts;
+  struct job_t *job;
+  int ms;
+
+  out_flush();                                   // the job owns the terminal until it is done
+
+  if(event_loop)
+  {
+    while(fgpid(jobs)==pid)
+    {                                            // signals only arrive through sigfd in this mode, exits also through the pidfd
+      admit_run();
+      wait_signals(getjobpid(jobs,pid));
+    }
+    if((job=getjobpid(jobs,pid))!=NULL && job->state==ST)
+    {
+      sched_demote(job);
+    }
+    return;
+  }
+
+  Sigemptyset(&mask);
+  Sigaddset(&mask,SIGCHLD);
+  Sigaddset(&mask,SIGINT);
+  Sigaddset(&mask,SIGTSTP);
+  Sigprocmask(SIG_BLOCK,&mask,&prev);            // job state can only change inside the handlers, so block them while checking it
+
+  wait_mask=prev;                                // same mask as the caller but with the job control signals deliverable
+  sigdelset(&wait_mask,SIGCHLD);
+  sigdelset(&wait_mask,SIGINT);
+  sigdelset(&wait_mask,SIGTSTP);
+
+  while(fgpid(jobs)==pid)
+  {                                              // check if this job is still the foreground process
+    admit_run();                                 // background jobs may still be admitted meanwhile
+    if((ms=admit_timeout())<0)
+    {
+      sigsuspend(&wait_mask);                    // if yes then sleep until a handler has run
+    }
+    else
+    {                                            // or until the token bucket has a start for a queued job
+      ts.tv_sec=ms/1000;
+      ts.tv_nsec=ms%1000*1000000L;
+      ppoll(NULL,0,&ts,&wait_mask);
+    }
+  }
+  if((job=getjobpid(jobs,pid))!=NULL && job->state==ST)
+  {                                              // stopped: it drops back like a background job
+    sched_demote(job);
+  }
+
+  Sigprocmask(SIG_SETMASK,&prev,NULL);
+  return;
+}
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/* 
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
+ *     available zombie children, foreground or background, but doesn't
+ *     wait for any other currently running children to terminate.
+ *     SIGCHLDs that arrive while it runs are not queued, so one pass
+ *     covers a whole burst of exits; the notices from the pass are
+ *     collected and written together at the end.
+ */
+
+void sigchld_handler(int sig) 
+{
+      char note[SIGCHLDBUF], *np=note;            // job notices from this pass
+      struct rusage ru;
+      int olderrno=errno;
+      int status;
+      pid_t pid;
+      struct job_t *job;
+      while((pid = wait4(-1, &status, WNOHANG|WUNTRACED|WCONTINUED, &ru)) > 0) 
+      {                                            // every child that changed state, whatever job it belongs to
+        if ((job = getjobpid(jobs, pid)) == NULL)
+        {                                          // a stage of a job that is already gone
+            continue;
+        }
+        if (np > note + sizeof(note) - SIONOTE)
+        {                                          // no room for another notice
+            sio_put(note, np - note);
+            np = note;
+        }
+        if (WIFSTOPPED(status))
+        {                                          // the first stage to stop reports for the job and stops the rest
+            if (job->state != ST)
+            {
+                setjobstate(job, ST);
+                np = sio_jobmsg(np, job->jid, job->pid, "stopped", WSTOPSIG(status));
+                job_kill(job, SIGSTOP);
+            }
+            continue;
+        }
+        if (WIFCONTINUED(status))
+        {                                          // continued from outside the shell: it runs in the background
+            if (job->state == ST)
+            {
+                setjobstate(job, BG);
+            }
+            continue;
+        }
+        usage_add(&job->usage, &ru);               // what this process used, now that it is gone
+        if ((status = procdone(job, pid, status)) < 0)
+        {                                          // other stages are still running
+            continue;
+        }
+        if (WIFSIGNALED(status))
+        {                                          // killed by a signal, by ctrl-c or otherwise
+            np = sio_jobmsg(np, job->jid, job->pid, "terminated", WTERMSIG(status));
+        }
+        job_retire(job, status);                   // keep its numbers for jobs -l
+        deletejob(jobs, job->pid);
+      }
+      if (np > note)
+      {
+        sio_put(note, np - note);
+      }
+      errno=olderrno;
+      return;
+}
+
+
+/* 
+ * sigint_handler - The kernel sends a SIGINT to the shell whenver the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job.  
+ */
+void sigint_handler(int sig) 
+{
+       pid_t fp;        
+       fp=fgpid(jobs);//foreground process pid
+       if(fp>0)
+       {
+            job_kill(getjobpid(jobs,fp),SIGINT);   // sigchld_handler reports and deletes the job once it is gone
+       }
+       return;
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP.  
+ */
+void sigtstp_handler(int sig) 
+{
+  pid_t fp=fgpid(jobs);
+  if(fp>0)
+  {
+    setjobstate(getjobpid(jobs,fp),ST);
+      // changing the state of the foreground job to stopped
+    sio_job(pid2jid(fp),fp,"stopped",SIGTSTP);     // handlers may interrupt out_printf, so no stdio here
+      // printing the job that is stopped ie temporary killed but can be resumed from where it left
+    job_kill(getjobpid(jobs,fp),SIGSTOP);        
+      // killing by SIGSTOP signal  (temporary killing)                                                                                  
+  } 
+  return;
+}
+
+/********************
+ * End signal handlers
+ *********************/
+
+/*********************************************************
+ * Event loop helpers (-e): signals via signalfd, input via epoll
+ *********************************************************/
+
+/*
+ * init_event_loop - Block the job control signals for good and route
+ *    them through a signalfd, so the handlers above run synchronously
+ *    from the main loop instead of interrupting it.
+ */
+void init_event_loop(void)
+{
+  sigset_t mask;
+  struct epoll_event ev;
+
+  Sigemptyset(&mask);
+  Sigaddset(&mask, SIGCHLD);
+  Sigaddset(&mask, SIGINT);
+  Sigaddset(&mask, SIGTSTP);
+  Sigprocmask(SIG_BLOCK, &mask, NULL);
+
+  if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+    unix_error("signalfd error");
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    unix_error("epoll_create1 error");
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = sigfd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev) < 0)
+    unix_error("epoll_ctl error");
+
+  ev.data.fd = STDIN_FILENO;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0) {
+    if (errno != EPERM)
+      unix_error("epoll_ctl error");
+    stdin_pollable = 0;  /* regular files are always readable */
+  }
+}
+
+/*
+ * dispatch_signals - Drain the signalfd and run the matching handler
+ *    for every signal that is pending.
+ */
+void dispatch_signals(void)
+{
+  struct signalfd_siginfo si;
+
+  while (read(sigfd, &si, sizeof(si)) == sizeof(si)) {
+    switch (si.ssi_signo) {
+      case SIGCHLD:
+        sigchld_handler(SIGCHLD);
+        break;
+      case SIGINT:
+        sigint_handler(SIGINT);
+        break;
+      case SIGTSTP:
+        sigtstp_handler(SIGTSTP);
+        break;
+    }
+  }
+}
+
+/*
+ * wait_signals - Block until at least one signal is pending on the
+ *    signalfd or the job PID of job (if not NULL) has exited, then
+ *    dispatch the signals or reap. Also returns when admit_timeout
+ *    says a queued job can be started.
+ */
+void wait_signals(struct job_t *job)
+{
+  struct pollfd pfd[2];
+  int n = 1;
+
+  pfd[0].fd = sigfd;
+  pfd[0].events = POLLIN;
+  if (job != NULL && job->pidfd >= 0 && (job->nprocs < 2 || job->procs[0].status < 0)) {
+    pfd[1].fd = job->pidfd;       /* not once it is reaped: it would stay readable */
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    n = 2;
+  }
+  if (poll(pfd, n, admit_timeout()) < 0 && errno != EINTR)
+    unix_error("poll error");
+  if (n == 2 && pfd[1].revents != 0)
+    sigchld_handler(SIGCHLD);
+  dispatch_signals();
+}
+
+/*
+ * read_cmdline - The shell's getline(). Returns the next input line in
+ *    *bufp (grown as needed, like getline) or NULL on end of file. The
+ *    output buffer is flushed only when no complete line is buffered
+ *    and it has to wait for more. In event loop mode it waits on stdin,
+ *    the signalfd and the job pidfds together, handling signals and
+ *    job exits as they come in.
+ */
+char *read_cmdline(char **bufp, size_t *capp)
+{
+  static char *inbuf = NULL;    /* bytes read but not yet returned */
+  static size_t inlen = 0, incap = 0;
+  static size_t scanned = 0;    /* no newline in inbuf[0..scanned) */
+  static int eof = 0;
+  struct epoll_event ev;
+  char *nl;
+  ssize_t n;
+  size_t len;
+
+  while (1) {
+    if (event_loop)
+      dispatch_signals();
+    admit_run();
+
+    nl = memchr(inbuf + scanned, '\n', inlen - scanned);
+    if (nl != NULL) {
+      len = nl - inbuf + 1;
+      if (*capp < len + 1) {
+        if ((*bufp = realloc(*bufp, len + 1)) == NULL)
+          unix_error("realloc error");
+        *capp = len + 1;
+      }
+      memcpy(*bufp, inbuf, len);
+      (*bufp)[len] = '\0';
+      inlen -= len;
+      memmove(inbuf, inbuf + len, inlen);
+      scanned = 0;
+      return *bufp;
+    }
+    scanned = inlen;
+    if (eof)
+      return NULL;   /* like getline+feof, a final partial line is dropped */
+
+    out_flush();     /* about to block: the prompt and earlier output must be seen */
+    if (event_loop && stdin_pollable) {
+      if ((n = epoll_wait(epfd, &ev, 1, admit_timeout())) < 0) {
+        if (errno == EINTR)
+          continue;
+        unix_error("epoll_wait error");
+      }
+      if (n == 0)
+        continue;    /* the token bucket has a start for a queued job */
+      if (ev.data.fd != STDIN_FILENO) {
+        if (ev.data.fd != sigfd)
+          sigchld_handler(SIGCHLD);  /* a job's pidfd: it has exited */
+        continue;
+      }
+    }
+    else if (!event_loop && nqueued > 0)
+      admit_poll(STDIN_FILENO);      /* read would sleep through the SIGCHLDs that make room */
+
+    if (incap - inlen < MAXLINE) {
+      incap = (incap == 0) ? 4 * MAXLINE : 2 * incap;
+      if ((inbuf = realloc(inbuf, incap)) == NULL)
+        unix_error("realloc error");
+    }
+    if ((n = read(STDIN_FILENO, inbuf + inlen, incap - inlen)) < 0) {
+      if (errno == EINTR)
+        continue;
+      app_error("read error");
+    }
+    if (n == 0)
+      eof = 1;
+    inlen += n;
+  }
+}
+
+/*********************************************************
+ * Output buffer: everything the shell prints goes through outbuf
+ *********************************************************/
+
+/*
+ * The main program appends to outbuf and it is written out only at the
+ * flush points: when read_cmdline is about to block, when a foreground
+ * job takes over (waitfg), before children that share fd 1 are started,
+ * and at exit. The signal handlers never touch stdio; sio_job writes
+ * straight to fd 1, draining outbuf first unless out_busy says the main
+ * program is in the middle of changing it.
+ */
+
+/* out_enter, out_leave - Bracket changes to outbuf/outlen */
+static void out_enter(void)
+{
+  out_busy = 1;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static void out_leave(void)
+{
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  out_busy = 0;
+}
+
+/* write_all - write(2) all n bytes, retrying on EINTR. Async-signal-safe */
+static void write_all(int fd, const char *buf, size_t n)
+{
+  ssize_t rc;
+
+  while (n > 0) {
+    if ((rc = write(fd, buf, n)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;          /* nowhere left to report it */
+    }
+    buf += rc;
+    n -= rc;
+  }
+}
+
+/* out_drain - Write out outbuf. Caller is between out_enter/out_leave */
+static void out_drain(void)
+{
+  write_all(STDOUT_FILENO, outbuf, outlen);
+  outlen = 0;
+}
+
+/* out_flush - Write out whatever the shell has buffered */
+void out_flush(void)
+{
+  if (outlen == 0)
+    return;
+  out_enter();
+  out_drain();
+  out_leave();
+}
+
+/* out_write - Append n bytes to the output buffer */
+void out_write(const char *s, size_t n)
+{
+  out_enter();
+  if (outlen + n > OUTBUF)
+    out_drain();
+  if (n >= OUTBUF)
+    write_all(STDOUT_FILENO, s, n);
+  else {
+    memcpy(outbuf + outlen, s, n);
+    outlen += n;
+  }
+  out_leave();
+}
+
+/* out_vprintf - vprintf into the output buffer */
+void out_vprintf(const char *fmt, va_list ap)
+{
+  va_list aq;
+  char *big;
+  int n;
+
+  out_enter();
+  va_copy(aq, ap);
+  n = vsnprintf(outbuf + outlen, OUTBUF - outlen, fmt, aq);
+  va_end(aq);
+  if (n >= 0 && outlen + n >= OUTBUF) {   /* did not fit: drain and try again */
+    out_drain();
+    if (n < OUTBUF)
+      vsnprintf(outbuf, OUTBUF, fmt, ap);
+    else if ((big = malloc(n + 1)) != NULL) {
+      vsnprintf(big, n + 1, fmt, ap);
+      write_all(STDOUT_FILENO, big, n);
+      free(big);
+      n = 0;
+    }
+    else
+      n = 0;
+  }
+  if (n > 0)
+    outlen += n;
+  out_leave();
+}
+
+/* out_printf - printf into the output buffer */
+void out_printf(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  out_vprintf(fmt, ap);
+  va_end(ap);
+}
+
+/*
+ * out_writev - Output iov[1..n]. Small output is copied into outbuf;
+ *    otherwise outbuf goes in iov[0] and everything is written with
+ *    one writev call (more only on a partial write).
+ */
+void out_writev(struct iovec *iov, int n)
+{
+  size_t total = 0;
+  ssize_t rc;
+  int i;
+
+  for (i = 1; i <= n; i++)
+    total += iov[i].iov_len;
+  out_enter();
+  if (outlen + total <= OUTBUF) {
+    for (i = 1; i <= n; i++) {
+      memcpy(outbuf + outlen, iov[i].iov_base, iov[i].iov_len);
+      outlen += iov[i].iov_len;
+    }
+    out_leave();
+    return;
+  }
+
+  iov[0].iov_base = outbuf;
+  iov[0].iov_len = outlen;
+  i = 0;
+  n++;
+  while (i < n) {
+    if ((rc = writev(STDOUT_FILENO, iov + i, n - i)) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    while (i < n && rc >= (ssize_t)iov[i].iov_len)
+      rc -= iov[i++].iov_len;
+    if (i < n) {
+      iov[i].iov_base = (char *)iov[i].iov_base + rc;
+      iov[i].iov_len -= rc;
+    }
+  }
+  outlen = 0;
+  out_leave();
+}
+
+/* sio_int - Append the decimal form of v at p. Async-signal-safe */
+static char *sio_int(char *p, long v)
+{
+  char tmp[24];
+  int n = 0;
+
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+  do
+    tmp[n++] = '0' + v % 10;
+  while ((v /= 10) != 0);
+  while (n > 0)
+    *p++ = tmp[--n];
+  return p;
+}
+
+/* sio_jobmsg - Format "Job [jid] (pid) <what> by signal <sig>\n" at p */
+char *sio_jobmsg(char *p, int jid, pid_t pid, const char *what, int sig)
+{
+  memcpy(p, "Job [", 5);
+  p = sio_int(p + 5, jid);
+  memcpy(p, "] (", 3);
+  p = sio_int(p + 3, pid);
+  *p++ = ')';
+  *p++ = ' ';
+  while (*what)
+    *p++ = *what++;
+  memcpy(p, " by signal ", 11);
+  p = sio_int(p + 11, sig);
+  *p++ = '\n';
+  return p;
+}
+
+/*
+ * sio_put - Write msg from a signal handler, after anything the main
+ *    program had buffered. Async-signal-safe.
+ */
+void sio_put(const char *msg, size_t n)
+{
+  if (!out_busy && outlen > 0) {
+    write_all(STDOUT_FILENO, outbuf, outlen);
+    outlen = 0;
+  }
+  write_all(STDOUT_FILENO, msg, n);
+}
+
+/* sio_job - Print "Job [jid] (pid) <what> by signal <sig>" from a handler */
+void sio_job(int jid, pid_t pid, const char *what, int sig)
+{
+  char msg[SIONOTE];
+
+  sio_put(msg, sio_jobmsg(msg, jid, pid, what, sig) - msg);
+}
+
+/*********************************************************
+ * Command hash table: PATH lookups cached by command name
+ *********************************************************/
+
+/* hash_name - Bucket index for a command name */
+unsigned int hash_name(const char *name)
+{
+  unsigned int h = 5381;
+
+  while (*name)
+    h = h * 33 + (unsigned char)*name++;
+  return h % CMDHASH;
+}
+
+/* hash_find - Find a cached lookup (positive or negative) by name */
+struct cmd_t *hash_find(const char *name)
+{
+  struct cmd_t *cmd;
+
+  for (cmd = cmdtab[hash_name(name)]; cmd != NULL; cmd = cmd->next)
+    if (strcmp(cmd->name, name) == 0)
+      return cmd;
+  return NULL;
+}
+
+/*
+ * hash_add - Search PATH for name and cache the result. A failed
+ *    search is cached too, so a missing command costs one probe of
+ *    the directories until one of them changes.
+ */
+struct cmd_t *hash_add(char *name)
+{
+  struct cmd_t *cmd;
+  struct stat st;
+  char *dirs, *dir, *save, *path;
+  unsigned int h;
+
+  hash_forget(name);
+  if ((cmd = malloc(sizeof(struct cmd_t))) == NULL || (cmd->name = strdup(name)) == NULL)
+    unix_error("malloc error");
+  cmd->path = NULL;
+  cmd->fd = -1;
+  cmd->hits = 0;
+
+  if ((dirs = strdup(hashed_path)) == NULL)
+    unix_error("malloc error");
+  for (dir = strtok_r(dirs, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save)) {
+    if ((path = malloc(strlen(dir) + strlen(name) + 2)) == NULL)
+      unix_error("malloc error");
+    sprintf(path, "%s/%s", dir, name);
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+      cmd->path = path;
+      cmd->fd = open(path, O_PATH | O_CLOEXEC);
+      break;
+    }
+    free(path);
+  }
+  free(dirs);
+
+  h = hash_name(name);
+  cmd->next = cmdtab[h];
+  cmdtab[h] = cmd;
+  return cmd;
+}
+
+/* hash_forget - Drop the cached lookup for name, if any */
+void hash_forget(const char *name)
+{
+  struct cmd_t **pp, *cmd;
+
+  for (pp = &cmdtab[hash_name(name)]; (cmd = *pp) != NULL; pp = &cmd->next) {
+    if (strcmp(cmd->name, name) == 0) {
+      *pp = cmd->next;
+      if (cmd->fd >= 0)
+        close(cmd->fd);
+      free(cmd->path);
+      free(cmd->name);
+      free(cmd);
+      return;
+    }
+  }
+}
+
+/* hash_clear - Drop every cached lookup */
+void hash_clear(void)
+{
+  int i;
+
+  for (i = 0; i < CMDHASH; i++)
+    while (cmdtab[i] != NULL)
+      hash_forget(cmdtab[i]->name);
+}
+
+/*
+ * hash_sync - Bring the table (and the completion trie) up to date
+ *    before it is used. A new PATH empties it and moves the inotify
+ *    watches to the new directories; otherwise any name created,
+ *    removed or renamed in a watched directory is forgotten so the
+ *    next use searches again.
+ */
+void hash_sync(void)
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *ev;
+  char *path, *dirs, *dir, *save;
+  ssize_t n;
+  char *p;
+
+  if ((path = getenv("PATH")) == NULL)
+    path = "";
+  if (hashed_path == NULL || strcmp(path, hashed_path) != 0) {
+    hash_clear();
+    comp_reset();
+    free(hashed_path);
+    if ((hashed_path = strdup(path)) == NULL || (dirs = strdup(path)) == NULL)
+      unix_error("malloc error");
+    if (inotify_fd >= 0)
+      close(inotify_fd);
+    if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0)
+      for (dir = strtok_r(dirs, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save))
+        inotify_add_watch(inotify_fd, dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+            IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+    free(dirs);
+    return;
+  }
+
+  if (inotify_fd < 0)
+    return;
+  while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event *)p;
+      if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        hash_clear();
+        comp_reset();
+      }
+      else if (ev->len > 0) {
+        hash_forget(ev->name);
+        comp_update(ev->name);
+      }
+    }
+  }
+}
+
+/*
+ * resolve_cmd - Map argv[0] to the file to execute. Names containing
+ *    a '/' are used as is; anything else goes through the hash table.
+ *    Returns NULL if the command is not on PATH. *fd is set to an
+ *    O_PATH descriptor for the file, or -1 if there is none.
+ */
+char *resolve_cmd(char *name, int *fd)
+{
+  struct cmd_t *cmd;
+
+  *fd = -1;
+  if (strchr(name, '/') != NULL)
+    return name;
+
+  hash_sync();
+  if ((cmd = hash_find(name)) == NULL)
+    cmd = hash_add(name);
+  if (cmd->path == NULL)
+    return NULL;
+  cmd->hits++;
+  *fd = cmd->fd;
+  return cmd->path;
+}
+
+/*
+ * do_hash - Execute the builtin hash command
+ *    hash            list the remembered commands
+ *    hash name ...   look up each name and remember it
+ *    hash -r         forget every remembered command
+ */
+void do_hash(char **argv)
+{
+  struct cmd_t *cmd;
+  int i, n = 0;
+
+  hash_sync();
+  if (argv[1] == NULL) {
+    for (i = 0; i < CMDHASH; i++) {
+      for (cmd = cmdtab[i]; cmd != NULL; cmd = cmd->next) {
+        if (cmd->path == NULL)
+          continue;
+        if (n++ == 0)
+          out_printf("hits\tcommand\n");
+        out_printf("%4d\t%s\n", cmd->hits, cmd->path);
+      }
+    }
+    if (n == 0)
+      out_printf("hash: hash table empty\n");
+    return;
+  }
+
+  if (strcmp(argv[1], "-r") == 0) {
+    hash_clear();
+    return;
+  }
+  if (argv[1][0] == '-') {
+    out_printf("hash: usage: hash [-r] [name ...]\n");
+    return;
+  }
+  for (i = 1; argv[i] != NULL; i++)
+    if (strchr(argv[i], '/') == NULL && hash_add(argv[i])->path == NULL)
+      out_printf("hash: %s: not found\n", argv[i]);
+}
+
+/*************************************************************
+ * Completion: command names from a trie, arguments from the directory
+ *
+ * The names of the builtins and of every executable on PATH are kept
+ * in a trie, built the first time a command name is completed. Each
+ * node's children are a sibling list in character order, so a walk of
+ * the trie lists names sorted, and each node counts the names at or
+ * below it, so a walk skips subtrees whose names are all gone. The
+ * inotify events hash_sync reads keep it current one name at a time;
+ * a removed name only clears its node's flag, and the nodes are freed
+ * when PATH changes or the watches are lost and the trie is rebuilt.
+ *************************************************************/
+
+/* comp_reset - Drop the trie; the next completion builds it again */
+void comp_reset(void)
+{
+  ntrie = 0;
+}
+
+/* trie_node - Add a node for character c, returning its index */
+static uint32_t trie_node(unsigned char c)
+{
+  if (ntrie == triecap) {
+    triecap = (triecap == 0) ? 4096 : 2 * triecap;
+    if ((trie = realloc(trie, triecap * sizeof(struct tnode_t))) == NULL)
+      unix_error("realloc error");
+  }
+  memset(&trie[ntrie], 0, sizeof(struct tnode_t));
+  trie[ntrie].c = c;
+  return ntrie++;
+}
+
+/* trie_find - The node name leads to, added if add is set; 0 if there is none */
+static uint32_t trie_find(const char *name, int add)
+{
+  uint32_t n = 0, k, prev, m;
+  unsigned char c;
+
+  for (; (c = *name) != '\0'; name++) {
+    for (prev = 0, k = trie[n].child; k != 0 && trie[k].c < c; prev = k, k = trie[k].sibling)
+      ;
+    if (k == 0 || trie[k].c != c) {
+      if (!add)
+        return 0;
+      m = trie_node(c);     /* may move trie: only indices are held */
+      trie[m].sibling = k;
+      if (prev == 0)
+        trie[n].child = m;
+      else
+        trie[prev].sibling = m;
+      k = m;
+    }
+    n = k;
+  }
+  return n;
+}
+
+/*
+ * trie_set - Set (on) or clear flag on name's node, keeping the live
+ *    counts of the nodes above it right.
+ */
+static void trie_set(const char *name, int flag, int on)
+{
+  uint32_t n = trie_find(name, on), k;
+  int was, delta;
+  const char *p;
+
+  if (n == 0)
+    return;
+  was = trie[n].flags != 0;
+  trie[n].flags = on ? (trie[n].flags | flag) : (trie[n].flags & ~flag);
+  if ((delta = (trie[n].flags != 0) - was) == 0)
+    return;
+  trie[0].live += delta;
+  for (k = 0, p = name; *p != '\0'; p++) {
+    for (k = trie[k].child; trie[k].c != (unsigned char)*p; k = trie[k].sibling)
+      ;
+    trie[k].live += delta;
+  }
+}
+
+/* comp_probe - True if name is an executable file in a directory on PATH */
+static int comp_probe(const char *name)
+{
+  char *dirs, *dir, *save;
+  struct stat st;
+  int fd, found = 0;
+
+  if ((dirs = strdup(hashed_path)) == NULL)
+    unix_error("malloc error");
+  for (dir = strtok_r(dirs, ":", &save); dir != NULL && !found; dir = strtok_r(NULL, ":", &save)) {
+    if ((fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0)
+      continue;
+    found = fstatat(fd, name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+            faccessat(fd, name, X_OK, 0) == 0;
+    close(fd);
+  }
+  free(dirs);
+  return found;
+}
+
+/* comp_build - Fill the trie with the builtins and everything executable on PATH */
+static void comp_build(void)
+{
+  char *dirs, *dir, *save;
+  struct dirent *de;
+  struct stat st;
+  DIR *d;
+  int i;
+
+  ntrie = 0;
+  trie_node(0);
+  for (i = 0; i < BI_SLOTS; i++)
+    if (builtins[i].name != NULL)
+      trie_set(builtins[i].name, TRIE_BUILTIN, 1);
+  if ((dirs = strdup(hashed_path)) == NULL)
+    unix_error("malloc error");
+  for (dir = strtok_r(dirs, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save)) {
+    if ((d = opendir(dir)) == NULL)
+      continue;
+    while ((de = readdir(d)) != NULL) {
+      if (de->d_name[0] == '.' || (de->d_type != DT_REG && de->d_type != DT_LNK &&
+                                   de->d_type != DT_UNKNOWN))
+        continue;
+      if (fstatat(dirfd(d), de->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+          faccessat(dirfd(d), de->d_name, X_OK, 0) == 0)
+        trie_set(de->d_name, TRIE_PATH, 1);
+    }
+    closedir(d);
+  }
+  free(dirs);
+}
+
+/* comp_update - Look name up on PATH again after an inotify event for it */
+void comp_update(const char *name)
+{
+  if (ntrie > 0)
+    trie_set(name, TRIE_PATH, comp_probe(name));
+}
+
+/* comp_walk - Print the names at or below node n, whose name is buf[0..len) */
+static void comp_walk(uint32_t n, char *buf, size_t len)
+{
+  uint32_t k;
+
+  if (trie[n].flags != 0) {
+    buf[len] = '\n';
+    out_write(buf, len + 1);
+  }
+  for (k = trie[n].child; k != 0; k = trie[k].sibling) {
+    if (trie[k].live == 0 || len >= NAME_MAX)
+      continue;
+    buf[len] = trie[k].c;
+    comp_walk(k, buf, len + 1);
+  }
+}
+
+/*
+ * comp_commands - Print the builtins and commands on PATH that start
+ *    with prefix, in order. Returns the number of them.
+ */
+int comp_commands(const char *prefix)
+{
+  char buf[NAME_MAX + 1];     /* a name and its newline */
+  size_t len = strlen(prefix);
+  uint32_t n;
+
+  hash_sync();
+  if (ntrie == 0)
+    comp_build();
+  if (len > NAME_MAX || ((n = trie_find(prefix, 0)) == 0 && len > 0) || trie[n].live == 0)
+    return 0;
+  memcpy(buf, prefix, len);
+  comp_walk(n, buf, len);
+  return trie[n].live;
+}
+
+/* comp_cmp - qsort order of file names */
+static int comp_cmp(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * comp_files - Print the files that word could be completed to, in
+ *    order, directories with a trailing '/'. Dot files are only listed
+ *    if word's last component starts with a dot. Returns the number of
+ *    them.
+ */
+int comp_files(const char *word)
+{
+  const char *base = strrchr(word, '/');
+  char *dir, **names = NULL;
+  size_t dirlen, baselen;
+  struct dirent *de;
+  struct stat st;
+  int n = 0, cap = 0, i, isdir;
+  DIR *d;
+
+  base = (base != NULL) ? base + 1 : word;
+  dirlen = base - word;
+  baselen = strlen(base);
+  if ((dir = strndup(word, dirlen)) == NULL)
+    unix_error("malloc error");
+  if ((d = opendir(dirlen > 0 ? dir : ".")) == NULL) {
+    free(dir);
+    return 0;
+  }
+  while ((de = readdir(d)) != NULL) {
+    if (strncmp(de->d_name, base, baselen) != 0 || (de->d_name[0] == '.' && base[0] != '.') ||
+        strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    isdir = (de->d_type == DT_DIR) || ((de->d_type == DT_LNK || de->d_type == DT_UNKNOWN) &&
+            fstatat(dirfd(d), de->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+    if (n == cap) {
+      cap = (cap == 0) ? 64 : 2 * cap;
+      if ((names = realloc(names, cap * sizeof(char *))) == NULL)
+        unix_error("realloc error");
+    }
+    if ((names[n] = malloc(dirlen + strlen(de->d_name) + 2)) == NULL)
+      unix_error("malloc error");
+    sprintf(names[n++], "%s%s%s", dir, de->d_name, isdir ? "/" : "");
+  }
+  closedir(d);
+  qsort(names, n, sizeof(char *), comp_cmp);
+  for (i = 0; i < n; i++) {
+    out_printf("%s\n", names[i]);
+    free(names[i]);
+  }
+  free(names);
+  free(dir);
+  return n;
+}
+
+/*************************************************************
+ * Command line arena: job command lines, interned and shared
+ *
+ * Every distinct command line is stored once in cmdarena, a single
+ * growable buffer, as a struct cmdent_t header followed by the text.
+ * Jobs, and the finished jobs in donering, hold the entry's offset (a
+ * handle, 0 meaning none). Entries
+ * are reference counted; an entry nobody uses stays in the intern
+ * table so a repeated command finds it again, and the space is only
+ * reclaimed by compacting the arena from cmd_intern(). Compaction
+ * moves strings, so it never happens from a signal handler:
+ * cmd_release() only drops the count.
+ *************************************************************/
+
+/* cmdent - Header of the entry at handle h */
+static struct cmdent_t *cmdent(uint32_t h)
+{
+  return (struct cmdent_t *)(cmdarena + h);
+}
+
+/* cmd_entsize - Bytes taken by an entry whose text is len long */
+static uint32_t cmd_entsize(uint32_t len)
+{
+  return (sizeof(struct cmdent_t) + len + 1 + 15) & ~15u;
+}
+
+/* cmd_hash - FNV-1a hash of a command line */
+static uint32_t cmd_hash(const char *s, uint32_t len)
+{
+  uint32_t h = 2166136261u;
+
+  while (len-- > 0)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+/* cmd_rehash - Rebuild the intern table over every entry in the arena */
+static void cmd_rehash(uint32_t nbuckets)
+{
+  struct cmdent_t *e;
+  uint32_t h, b;
+
+  free(cmdbuckets);
+  if ((cmdbuckets = calloc(nbuckets, sizeof(uint32_t))) == NULL)
+    unix_error("calloc error");
+  ncmdbuckets = nbuckets;
+  for (h = CMDARENA_START; h < cmdarena_used; h += cmd_entsize(e->len)) {
+    e = cmdent(h);
+    b = e->hash & (ncmdbuckets - 1);
+    e->next = cmdbuckets[b];
+    cmdbuckets[b] = h;
+  }
+}
+
+/*
+ * cmd_compact - Squeeze out entries no job uses. Each live entry's new
+ *    handle is left in its old header so the jobs can be pointed at it.
+ */
+static void cmd_compact(void)
+{
+  struct cmdent_t *e;
+  char *newarena;
+  uint32_t h, to, size;
+  int i;
+
+  if ((newarena = malloc(cmdarena_size)) == NULL)
+    unix_error("malloc error");
+  to = CMDARENA_START;
+  for (h = CMDARENA_START; h < cmdarena_used; h += size) {
+    e = cmdent(h);
+    size = cmd_entsize(e->len);
+    if (e->refs > 0) {
+      memcpy(newarena + to, e, size);
+      e->next = to;
+      to += size;
+    }
+    else
+      ncmdents--;
+  }
+  for (i = 0; i < jobs_hwm; i++)
+    if (jobs[i].cmd != 0)
+      jobs[i].cmd = cmdent(jobs[i].cmd)->next;
+  for (i = 0; i < DONERING && i < ndone; i++)
+    if (donering[i].cmd != 0)
+      donering[i].cmd = cmdent(donering[i].cmd)->next;
+
+  free(cmdarena);
+  cmdarena = newarena;
+  cmdarena_used = to;
+  cmdarena_dead = 0;
+  cmd_rehash(ncmdbuckets);
+}
+
+/*
+ * cmd_intern - Return a counted handle for the len byte command line
+ *    at s, reusing the existing copy if the same line has been seen
+ *    before. The copy is NUL terminated.
+ */
+uint32_t cmd_intern(const char *s, uint32_t len)
+{
+  struct cmdent_t *e;
+  uint32_t hash = cmd_hash(s, len), h, size;
+
+  for (h = cmdbuckets[hash & (ncmdbuckets - 1)]; h != 0; h = e->next) {
+    e = cmdent(h);
+    if (e->hash == hash && e->len == len && memcmp(e + 1, s, len) == 0) {
+      if (e->refs++ == 0)
+        cmdarena_dead -= cmd_entsize(len);
+      return h;
+    }
+  }
+
+  size = cmd_entsize(len);
+  if (cmdarena_dead > cmdarena_used / 2 && cmdarena_dead >= CMDARENA_MIN)
+    cmd_compact();
+  if (cmdarena_used + size > cmdarena_size) {
+    while (cmdarena_used + size > cmdarena_size)
+      cmdarena_size *= 2;
+    if ((cmdarena = realloc(cmdarena, cmdarena_size)) == NULL)
+      unix_error("realloc error");
+  }
+
+  h = cmdarena_used;
+  cmdarena_used += size;
+  e = cmdent(h);
+  e->refs = 1;
+  e->hash = hash;
+  e->len = len;
+  memcpy(e + 1, s, len);
+  ((char *)(e + 1))[len] = '\0';
+  e->next = cmdbuckets[hash & (ncmdbuckets - 1)];
+  cmdbuckets[hash & (ncmdbuckets - 1)] = h;
+  if (++ncmdents > 2 * ncmdbuckets)
+    cmd_rehash(2 * ncmdbuckets);
+  return h;
+}
+
+/* cmd_release - Drop a reference taken by cmd_intern */
+void cmd_release(uint32_t h)
+{
+  struct cmdent_t *e;
+
+  if (h == 0)
+    return;
+  e = cmdent(h);
+  if (--e->refs == 0)
+    cmdarena_dead += cmd_entsize(e->len);
+}
+
+/* cmd_reset - Empty the arena, allocating it on first use */
+void cmd_reset(void)
+{
+  if (cmdarena == NULL) {
+    cmdarena_size = CMDARENA_MIN;
+    if ((cmdarena = malloc(cmdarena_size)) == NULL)
+      unix_error("malloc error");
+  }
+  cmdarena_used = CMDARENA_START;
+  cmdarena_dead = 0;
+  ncmdents = 0;
+  cmd_rehash(CMDARENA_MIN / 64);
+}
+
+/* jobcmd - The command line of a job */
+char *jobcmd(struct job_t *job)
+{
+  if (job->cmd == 0)
+    return "";
+  return (char *)(cmdent(job->cmd) + 1);
+}
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ *
+ * There is a single job table, jobs, grown by doubling up to MAXJOBS
+ * slots. A job is found by pid (its own, which is also its process
+ * group, or that of any live pipeline stage) through an open-addressed hash index
+ * and by jid through a direct-mapped index, and the foreground job is
+ * remembered in fgslot, so none of the lookups scan the table. Job
+ * IDs come from a bitmap allocator that hands out the smallest free
+ * ID, and slots are likewise reused lowest first. The
+ * jobs argument is kept for compatibility and must be the global
+ * table; helpers that may grow it go through growjobs().
+ **********************************************/
+
+/* pidslot - Home bucket of pid in the pid index */
+static unsigned int pidslot(pid_t pid)
+{
+  return ((unsigned int)pid * 2654435761u) & (pidcap - 1);
+}
+
+/* pidindex_get - Slot of the job with pid as its PID or a stage PID, or -1 */
+static int pidindex_get(pid_t pid)
+{
+  unsigned int i;
+
+  if (pidcap == 0)
+    return -1;
+  for (i = pidslot(pid); pidindex[i].pid != 0; i = (i + 1) & (pidcap - 1))
+    if (pidindex[i].pid == pid)
+      return pidindex[i].slot;
+  return -1;
+}
+
+/* pidindex_put - Record that pid belongs to the job in slot */
+static void pidindex_put(pid_t pid, int slot)
+{
+  unsigned int i;
+
+  for (i = pidslot(pid); pidindex[i].pid != 0; i = (i + 1) & (pidcap - 1))
+    ;
+  pidindex[i].pid = pid;
+  pidindex[i].slot = slot;
+}
+
+/*
+ * pidindex_del - Remove pid from the pid index, shifting later
+ *    entries of the probe run back so no tombstones are needed.
+ */
+static void pidindex_del(pid_t pid)
+{
+  unsigned int i, j, home;
+
+  for (i = pidslot(pid); pidindex[i].pid != 0; i = (i + 1) & (pidcap - 1))
+    if (pidindex[i].pid == pid)
+      break;
+  if (pidindex[i].pid == 0)
+    return;
+
+  for (j = (i + 1) & (pidcap - 1); pidindex[j].pid != 0; j = (j + 1) & (pidcap - 1)) {
+    home = pidslot(pidindex[j].pid);
+    if (((j - home) & (pidcap - 1)) >= ((j - i) & (pidcap - 1))) {
+      pidindex[i] = pidindex[j];  /* entry j may move back into the hole */
+      i = j;
+    }
+  }
+  pidindex[i].pid = 0;
+}
+
+/*
+ * growjobs - Double the job table (and rebuild the pid index at twice
+ *    that size), returning the new table. Returns NULL if the table is
+ *    already MAXJOBS slots.
+ */
+static struct job_t *growjobs(void)
+{
+  struct job_t *newjobs;
+  int newmax, i, j;
+
+  newmax = (maxjobs == 0) ? INITJOBS : 2 * maxjobs;
+  if (newmax > MAXJOBS)
+    return NULL;
+  if ((newjobs = realloc(jobs, newmax * sizeof(struct job_t))) == NULL)
+    unix_error("realloc error");
+  jobs = newjobs;
+  for (i = maxjobs; i < newmax; i++)
+    clearjob(&jobs[i]);
+  maxjobs = newmax;
+
+  free(pidindex);
+  pidcap = 2 * newmax;
+  if ((pidindex = calloc(pidcap, sizeof(struct pident_t))) == NULL)
+    unix_error("calloc error");
+  for (i = 0; i < maxjobs; i++) {
+    if (jobs[i].pid != 0)
+      pidindex_put(jobs[i].pid, i);
+    for (j = 1; j < jobs[i].nprocs; j++)   /* stage 0 is the job PID */
+      if (jobs[i].procs[j].status < 0)
+        pidindex_put(jobs[i].procs[j].pid, i);
+  }
+  return jobs;
+}
+
+/* clearjob - Clear the entries in a job struct */
+void clearjob(struct job_t *job) {
+  job->pid = 0;
+  job->jid = 0;
+  job->state = UNDEF;
+  job->cmd = 0;
+  job->nprocs = 1;
+  job->nlive = 1;
+  job->procs = NULL;
+  job->pidfd = -1;
+  memset(&job->usage, 0, sizeof(job->usage));
+  job->qclass = 0;
+  job->qprev = job->qnext = 0;
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct job_t *jobs) {
+  int i;
+
+  if (maxjobs == 0)
+    jobs = growjobs();
+  for (i = 0; i < maxjobs; i++) {
+    free(jobs[i].procs);
+    clearjob(&jobs[i]);
+  }
+  memset(pidindex, 0, pidcap * sizeof(struct pident_t));
+  memset(jidindex, 0, sizeof(jidindex));
+  memset(&jidmap, 0, sizeof(jidmap));
+  memset(&slotmap, 0, sizeof(slotmap));
+  cmd_reset();
+  ndone = 0;                       /* the ring's handles went with the arena */
+  fgslot = -1;
+  jobs_hwm = 0;
+  nbg = nqueued = 0;
+  memset(qhead, 0, sizeof(qhead));
+  memset(qtail, 0, sizeof(qtail));
+}
+
+/*
+ * idmap_alloc - Take the smallest ID not in use, or -1 if all MAXJID
+ *    are taken. m->full says which words of m->map have no clear bit,
+ *    so this looks at one m->full word per 4096 IDs and then a single
+ *    m->map word. Used for both job IDs and job table slots.
+ */
+int idmap_alloc(struct idmap_t *m)
+{
+  int i, w, b;
+
+  for (i = 0; i < MAXJID/64/64; i++)
+    if (~m->full[i] != 0)
+      break;
+  if (i == MAXJID/64/64)
+    return -1;
+  w = i * 64 + __builtin_ctzll(~m->full[i]);
+  b = __builtin_ctzll(~m->map[w]);
+  m->map[w] |= (uint64_t)1 << b;
+  if (~m->map[w] == 0)
+    m->full[w / 64] |= (uint64_t)1 << (w % 64);
+  return w * 64 + b;
+}
+
+/* idmap_free - Give an ID back to its allocator */
+void idmap_free(struct idmap_t *m, int id)
+{
+  int w = id / 64;
+
+  if (id < 0 || id >= MAXJID)
+    return;
+  m->map[w] &= ~((uint64_t)1 << (id % 64));
+  m->full[w / 64] &= ~((uint64_t)1 << (w % 64));
+}
+
+/* maxjid - Returns largest allocated job ID */
+int maxjid(struct job_t *jobs) 
+{
+  int i, max=0;
+
+  for (i = 0; i < jobs_hwm; i++)
+    if (jobs[i].jid > max)
+      max = jobs[i].jid;
+  return max;
+}
+
+/*
+ * setjobstate - Change the state of a job, keeping track of which job
+ *    (if any) is in the foreground and how many run in the background
+ */
+void setjobstate(struct job_t *job, int state)
+{
+  if (job->state == FG)
+    fgslot = -1;
+  if (job->state == BG)
+    nbg--;
+  job->state = state;
+  if (state == FG)
+    fgslot = job - jobs;
+  if (state == BG)
+    nbg++;
+}
+
+/* addjob - Add a job to the job list */
+int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
+{
+  return addjob_text(jobs, pid, state, cmdline, strlen(cmdline));
+}
+
+/*
+ * job_alloc - Take a slot and a job ID for a new job with PID pid (0
+ *    for a queued job, which has none yet) in state state, whose
+ *    command line is the len bytes at text. Returns NULL, having said
+ *    so, if the table is full.
+ */
+static struct job_t *job_alloc(pid_t pid, int state, const char *text, size_t len)
+{
+  int i, jid;
+
+  if ((i = idmap_alloc(&slotmap)) < 0) {
+    out_printf("Tried to create too many jobs\n");
+    return NULL;
+  }
+  if (i == maxjobs && growjobs() == NULL) {
+    idmap_free(&slotmap, i);
+    out_printf("Tried to create too many jobs\n");
+    return NULL;
+  }
+  if (i >= jobs_hwm)
+    jobs_hwm = i + 1;
+  jid = idmap_alloc(&jidmap) + 1;  /* never fails: there are as many jids as slots */
+
+  jobs[i].pid = pid;
+  setjobstate(&jobs[i], state);
+  jobs[i].jid = jid;
+  jobs[i].cmd = cmd_intern(text, len);
+  jobs[i].penalty = 0;
+  if (pid != 0)
+    pidindex_put(pid, i);
+  jidindex[jid] = i + 1;
+  return &jobs[i];
+}
+
+/*
+ * addjob_text - Add a job whose command line is the len bytes at text,
+ *    which need not be NUL terminated
+ */
+int addjob_text(struct job_t *jobs, pid_t pid, int state, const char *text, size_t len)
+{
+  struct job_t *job;
+
+  if (pid < 1)
+    return 0;
+  if ((job = job_alloc(pid, state, text, len)) == NULL)
+    return 0;
+                           if(verbose){
+    out_printf("Added job [%d] %d %s\n", job->jid, job->pid, jobcmd(job));
+  }
+  return 1;
+}
+
+/*
+ * addprocs - Record the n stages of a pipeline job, pids[0] being the
+ *    job PID it was added with
+ */
+void addprocs(struct job_t *job, pid_t *pids, int n)
+{
+  int i;
+
+  if (n < 2)
+    return;
+  if ((job->procs = malloc(n * sizeof(struct proc_t))) == NULL)
+    unix_error("malloc error");
+  for (i = 0; i < n; i++) {
+    job->procs[i].pid = pids[i];
+    job->procs[i].status = -1;
+    if (i > 0)
+      pidindex_put(pids[i], job - jobs);
+  }
+  job->nprocs = job->nlive = n;
+}
+
+/*
+ * job_track - Open a pidfd for the job PID of a job that was just
+ *    started (signals are still blocked, so it cannot have been
+ *    reaped). In event loop mode the pidfd is watched by epfd, so an
+ *    exit shows up there as well as through SIGCHLD. Without pidfds
+ *    (old kernel, or out of descriptors) the job is tracked by pid
+ *    alone.
+ */
+void job_track(struct job_t *job)
+{
+  struct epoll_event ev;
+
+  if (job == NULL)
+    return;
+  if ((job->pidfd = syscall(SYS_pidfd_open, job->pid, 0)) < 0) {
+    job->pidfd = -1;
+    return;
+  }
+  if (event_loop) {
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;  /* stays readable until the job is deleted */
+    ev.data.fd = job->pidfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, job->pidfd, &ev) < 0)
+      unix_error("epoll_ctl error");
+  }
+}
+
+/*
+ * job_kill - Send sig to the process group of job. The job PID names
+ *    the group, and its pidfd first confirms that it is still the
+ *    process the shell started. A job whose PID has been reaped is
+ *    signalled only if other stages are live, as they keep the group
+ *    ID from being reused.
+ */
+int job_kill(struct job_t *job, int sig)
+{
+  if (job->pidfd >= 0 && syscall(SYS_pidfd_send_signal, job->pidfd, 0, NULL, 0) < 0 &&
+      (job->nprocs < 2 || job->procs[0].status < 0)) {
+    errno = ESRCH;
+    return -1;
+  }
+  return kill(-job->pid, sig);
+}
+
+/*
+ * procdone - Note that stage pid of job was reaped with wait status
+ *    status. Returns the status the job as a whole ended with (that of
+ *    its last stage) once every stage is done, or -1 while some are
+ *    still live.
+ */
+int procdone(struct job_t *job, pid_t pid, int status)
+{
+  int i;
+
+  if (job->nprocs < 2)
+    return status;
+  for (i = 0; i < job->nprocs; i++) {
+    if (job->procs[i].pid == pid && job->procs[i].status < 0) {
+      job->procs[i].status = status;
+      job->nlive--;
+      if (i > 0)
+        pidindex_del(pid);  /* the job PID stays: it names the process group */
+    }
+  }
+  if (job->nlive > 0)
+    return -1;
+  return job->procs[job->nprocs - 1].status;
+}
+
+/* usage_add - Add the resources in ru to u */
+void usage_add(struct usage_t *u, const struct rusage *ru)
+{
+  u->utime += ru->ru_utime.tv_sec * 1000000ULL + ru->ru_utime.tv_usec;
+  u->stime += ru->ru_stime.tv_sec * 1000000ULL + ru->ru_stime.tv_usec;
+  if (ru->ru_maxrss > u->maxrss)
+    u->maxrss = ru->ru_maxrss;
+  u->minflt += ru->ru_minflt;
+  u->majflt += ru->ru_majflt;
+  u->nvcsw += ru->ru_nvcsw;
+  u->nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * job_retire - Record a job that ended with wait status status in
+ *    donering, about to be deleted. Its command line handle moves to
+ *    the ring with it; the entry it replaces lets go of its own. Only
+ *    counts change in the arena, so this is safe in sigchld_handler.
+ */
+void job_retire(struct job_t *job, int status)
+{
+  struct done_t *d = &donering[ndone % DONERING];
+
+  if (ndone >= DONERING)
+    cmd_release(d->cmd);
+  d->pid = job->pid;
+  d->jid = job->jid;
+  d->status = status;
+  d->cmd = job->cmd;
+  d->usage = job->usage;
+  job->cmd = 0;
+  ndone++;
+}
+
+/* job_free - Free the job in slot i, started or still queued */
+static void job_free(int i)
+{
+  int j;
+
+  if (jobs[i].state == QU)
+    admit_dequeue(&jobs[i]);
+  if (jobs[i].pid != 0)
+    pidindex_del(jobs[i].pid);
+  for (j = 1; j < jobs[i].nprocs; j++)
+    if (jobs[i].procs[j].status < 0)
+      pidindex_del(jobs[i].procs[j].pid);
+  free(jobs[i].procs);
+  if (jobs[i].pidfd >= 0)
+    close(jobs[i].pidfd);          /* also takes it out of epfd */
+  jidindex[jobs[i].jid] = 0;
+  idmap_free(&jidmap, jobs[i].jid - 1);
+  idmap_free(&slotmap, i);
+  cmd_release(jobs[i].cmd);
+  setjobstate(&jobs[i], UNDEF);
+  clearjob(&jobs[i]);
+  while (jobs_hwm > 0 && jobs[jobs_hwm - 1].jid == 0)
+    jobs_hwm--;                    /* trim trailing free slots */
+}
+
+/* deletejob - Delete the job that pid (its PID or a stage PID) belongs to */
+int deletejob(struct job_t *jobs, pid_t pid) 
+{
+  int i;
+       
+  if (pid < 1)
+    return 0;
+  if ((i = pidindex_get(pid)) < 0)
+    return 0;
+  job_free(i);
+  return 1;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct job_t *jobs) {
+  if (fgslot < 0)
+    return 0;
+  return jobs[fgslot].pid;
+}
+
+/* getjobpid  - Find a job (by PID) on the job list */
+struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
+  int i;
+
+  if (pid < 1)
+    return NULL;
+  if ((i = pidindex_get(pid)) < 0)
+    return NULL;
+  return &jobs[i];
+}
+
+/* getjobjid  - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct job_t *jobs, int jid) 
+{
+  if (jid < 1 || jid > MAXJID || jidindex[jid] == 0)
+    return NULL;
+  return &jobs[jidindex[jid] - 1];
+}
+
+/* pid2jid - Map process ID to job ID */
+int pid2jid(pid_t pid) 
+{
+  struct job_t *job;
+
+  if ((job = getjobpid(jobs, pid)) == NULL)
+    return 0;
+  return job->jid;
+}
+
+/*
+ * listjobs - Print the job list. The lines go out LISTBATCH at a time
+ *    through out_writev, each as the formatted "[jid] (pid) state "
+ *    part and the command line straight from the arena.
+ */
+void listjobs(struct job_t *jobs) 
+{
+  static struct iovec iov[2 * LISTBATCH + 1];  /* iov[0] is for out_writev */
+  static char head[LISTBATCH][96];
+  const char *state;
+  int i, n = 0;
+
+  for (i = 0; i < jobs_hwm; i++) {
+    if (jobs[i].jid != 0) {
+      switch (jobs[i].state) {
+        case BG: 
+          state = "Running ";
+          break;
+        case FG: 
+          state = "Foreground ";
+          break;
+        case ST: 
+          state = "Stopped ";
+          break;
+        case QU:
+          state = "Queued ";
+          break;
+        default:
+          state = NULL;
+      }
+      iov[2*n+1].iov_base = head[n];
+      if (jobs[i].state == QU)     /* no PID until it is started */
+        iov[2*n+1].iov_len = sprintf(head[n], "[%d] (-) %s", jobs[i].jid, state);
+      else if (state != NULL)
+        iov[2*n+1].iov_len = sprintf(head[n], "[%d] (%d) %s", jobs[i].jid, jobs[i].pid, state);
+      else
+        iov[2*n+1].iov_len = sprintf(head[n], "[%d] (%d) listjobs: Internal error: job[%d].state=%d ", 
+            jobs[i].jid, jobs[i].pid, i, jobs[i].state);
+      iov[2*n+2].iov_base = jobcmd(&jobs[i]);
+      iov[2*n+2].iov_len = strlen(iov[2*n+2].iov_base);
+      if (++n == LISTBATCH) {
+        out_writev(iov, 2 * n);
+        n = 0;
+      }
+    }
+  }
+  if (n > 0)
+    out_writev(iov, 2 * n);
+}
+/*
+ * proc_usage - Add what live process pid has used so far to u, from
+ *    /proc/<pid>/stat and /proc/<pid>/status. Returns -1 if it is gone.
+ */
+static int proc_usage(pid_t pid, struct usage_t *u)
+{
+  char path[64], buf[1024], *p;
+  unsigned long long utime, stime;
+  long minflt, majflt, tick = sysconf(_SC_CLK_TCK), v;
+  FILE *fp;
+  int n;
+
+  sprintf(path, "/proc/%d/stat", pid);
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  n = fread(buf, 1, sizeof(buf) - 1, fp);
+  fclose(fp);
+  buf[n] = '\0';
+  if ((p = strrchr(buf, ')')) == NULL ||   /* the name may hold spaces */
+      sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %ld %*u %ld %*u %llu %llu",
+             &minflt, &majflt, &utime, &stime) != 4)
+    return -1;
+  u->utime += utime * 1000000ULL / tick;
+  u->stime += stime * 1000000ULL / tick;
+  u->minflt += minflt;
+  u->majflt += majflt;
+
+  sprintf(path, "/proc/%d/status", pid);
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    if (sscanf(buf, "VmHWM: %ld", &v) == 1 && v > u->maxrss)
+      u->maxrss = v;
+    else if (sscanf(buf, "voluntary_ctxt_switches: %ld", &v) == 1)
+      u->nvcsw += v;
+    else if (sscanf(buf, "nonvoluntary_ctxt_switches: %ld", &v) == 1)
+      u->nivcsw += v;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/*
+ * print_usage - Print the usage line under a job in jobs -l, starting
+ *    with how it is placed if place is not NULL
+ */
+static void print_usage(const char *place, const struct usage_t *u)
+{
+  if (place != NULL)
+    out_printf("        %s", place);
+  out_printf("%s user %llu.%03llus sys %llu.%03llus maxrss %ldK "
+             "minflt %ld majflt %ld nvcsw %ld nivcsw %ld\n",
+             (place != NULL) ? "" : "       ",
+             (unsigned long long)u->utime / 1000000, (unsigned long long)u->utime / 1000 % 1000,
+             (unsigned long long)u->stime / 1000000, (unsigned long long)u->stime / 1000 % 1000,
+             u->maxrss, u->minflt, u->majflt, u->nvcsw, u->nivcsw);
+}
+
+/*
+ * listjobs_long - jobs -l: the job list with what each job has used so
+ *    far (its reaped processes plus its live ones) and how its leader
+ *    is placed now (CPUs, nice, policy, I/O priority), then the last DONERING jobs that finished,
+ *    oldest first, with their totals.
+ */
+void listjobs_long(struct job_t *jobs)
+{
+  static const char *states[] = { "Undefined", "Foreground", "Running", "Stopped", "Queued" };
+  struct usage_t u;
+  struct done_t *d;
+  char *cmd, place[320];
+  int i, j;
+
+  for (i = 0; i < jobs_hwm; i++) {
+    if (jobs[i].jid == 0)
+      continue;
+    if (jobs[i].state == QU) {
+      out_printf("[%d] (-) Queued %s", jobs[i].jid, jobcmd(&jobs[i]));
+      print_usage(NULL, &jobs[i].usage);
+      continue;
+    }
+    u = jobs[i].usage;
+    if (jobs[i].nprocs < 2)
+      proc_usage(jobs[i].pid, &u);
+    else
+      for (j = 0; j < jobs[i].nprocs; j++)
+        if (jobs[i].procs[j].status < 0)
+          proc_usage(jobs[i].procs[j].pid, &u);
+    place_format(jobs[i].pid, place, sizeof(place));
+    out_printf("[%d] (%d) %s %s", jobs[i].jid, jobs[i].pid, states[jobs[i].state], jobcmd(&jobs[i]));
+    print_usage(place, &u);
+  }
+
+  for (i = (ndone > DONERING) ? ndone - DONERING : 0; i < ndone; i++) {
+    d = &donering[i % DONERING];
+    cmd = (d->cmd == 0) ? "" : (char *)(cmdent(d->cmd) + 1);
+    if (WIFSIGNALED(d->status))
+      out_printf("[%d] (%d) Signal %d %s", d->jid, d->pid, WTERMSIG(d->status), cmd);
+    else if (WEXITSTATUS(d->status) != 0)
+      out_printf("[%d] (%d) Exit %d %s", d->jid, d->pid, WEXITSTATUS(d->status), cmd);
+    else
+      out_printf("[%d] (%d) Done %s", d->jid, d->pid, cmd);
+    print_usage(NULL, &d->usage);
+  }
+}
+
+/******************************
+ * end job list helper routines
+ ******************************/
+
+
+/***********************************************
+ * Admission queue for background jobs
+ *
+ * A background job is started only if fewer than admit_max jobs run
+ * in the background and the token bucket (admit_rate starts a
+ * second, saving up at most admit_burst) has a start to give, and no
+ * job is already waiting. Otherwise it goes in the job table as QU,
+ * with a job ID but no processes, at the back of the FIFO of its
+ * priority class; a higher class is always admitted first. Jobs are
+ * started from the main program only: admit_run is called wherever
+ * the shell waits (read_cmdline, waitfg) and after each command, and
+ * admit_timeout tells those waits when the bucket next has a start.
+ * fg or bg on a queued job starts it at once. With the defaults
+ * (admit -j 0 -r 0) nothing is ever queued.
+ **********************************************/
+
+/* admit_enqueue - Put job at the back of the queue of its class */
+void admit_enqueue(struct job_t *job)
+{
+  int slot = job - jobs + 1, c = job->qclass;
+
+  job->qprev = qtail[c];
+  job->qnext = 0;
+  if (qtail[c] != 0)
+    jobs[qtail[c] - 1].qnext = slot;
+  else
+    qhead[c] = slot;
+  qtail[c] = slot;
+  nqueued++;
+}
+
+/* admit_dequeue - Take job out of the queue of its class */
+void admit_dequeue(struct job_t *job)
+{
+  int c = job->qclass;
+
+  if (job->qprev != 0)
+    jobs[job->qprev - 1].qnext = job->qnext;
+  else
+    qhead[c] = job->qnext;
+  if (job->qnext != 0)
+    jobs[job->qnext - 1].qprev = job->qprev;
+  else
+    qtail[c] = job->qprev;
+  job->qprev = job->qnext = 0;
+  nqueued--;
+}
+
+/* admit_refill - Add the tokens earned since the last refill */
+static void admit_refill(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  admit_tokens += admit_rate * ((now.tv_sec - admit_last.tv_sec) +
+                                (now.tv_nsec - admit_last.tv_nsec) / 1e9);
+  if (admit_tokens > admit_burst)
+    admit_tokens = admit_burst;
+  admit_last = now;
+}
+
+/* admit_ok - True if a background job may be started now */
+static int admit_ok(void)
+{
+  if (admit_max > 0 && nbg >= admit_max)
+    return 0;
+  if (admit_rate > 0) {
+    admit_refill();
+    if (admit_tokens < 1)
+      return 0;
+  }
+  return 1;
+}
+
+/* admit_take - Use up the start that admit_ok allowed */
+static void admit_take(void)
+{
+  if (admit_rate > 0)
+    admit_tokens -= 1;
+}
+
+/*
+ * admit_bg - Ask to start a new background job with the len bytes at
+ *    text as its command line. Returns 1 if it may start now. If not,
+ *    it is queued and reported (or the table is full, which has been
+ *    reported too), and 0 is returned. Call with signals blocked.
+ */
+int admit_bg(const char *text, size_t len)
+{
+  struct job_t *job;
+
+  admit_run();                     /* the jobs already waiting go first */
+  if (nqueued == 0 && admit_ok()) {
+    admit_take();
+    return 1;
+  }
+  if ((job = job_alloc(0, QU, text, len)) != NULL) {
+    job->qclass = admit_class;
+    admit_enqueue(job);
+    out_printf("[%d] (-) Queued %s", job->jid, jobcmd(job));
+  }
+  return 0;
+}
+
+/*
+ * admit_start - Start queued job job now, whatever the limits, in the
+ *    background. Returns 1, or 0 if none of it could be started; the
+ *    reason has been printed and the job is gone.
+ */
+int admit_start(struct job_t *job)
+{
+  static struct cmdline_t cl;      /* not eval's: this can run while eval waits for a job */
+  sigset_t sig, prev;
+  pid_t *pids;
+  int n = 0, slot = job - jobs;
+
+  Sigemptyset(&sig);
+  Sigaddset(&sig, SIGCHLD);
+  Sigaddset(&sig, SIGINT);
+  Sigaddset(&sig, SIGTSTP);
+  Sigprocmask(SIG_BLOCK, &sig, &prev);
+  admit_dequeue(job);
+  setjobstate(job, BG);
+  if (parsecmd(jobcmd(job), &cl) > 0)
+    n = spawn_pipeline(&cl, &pids, &sig, &prev);
+  if (n == 0) {
+    job_free(slot);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+    return 0;
+  }
+  job->pid = pids[0];
+  job->penalty = sched_boost;      /* spawn_pipeline placed it as a background job */
+  pidindex_put(pids[0], slot);
+  addprocs(job, pids, n);
+  job_track(job);
+  Sigprocmask(SIG_SETMASK, &prev, NULL);
+  return 1;
+}
+
+/* admit_run - Start queued jobs, best class first, while the limits allow */
+void admit_run(void)
+{
+  sigset_t sig, prev;
+  int c;
+
+  if (nqueued == 0)
+    return;
+  Sigemptyset(&sig);
+  Sigaddset(&sig, SIGCHLD);
+  Sigaddset(&sig, SIGINT);
+  Sigaddset(&sig, SIGTSTP);
+  Sigprocmask(SIG_BLOCK, &sig, &prev);
+  while (nqueued > 0 && admit_ok()) {
+    for (c = 0; qhead[c] == 0; c++)
+      ;
+    admit_take();
+    admit_start(&jobs[qhead[c] - 1]);
+  }
+  Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ * admit_timeout - Milliseconds until the token bucket lets the next
+ *    queued job start, or -1 if no wait needs to end for admission:
+ *    nothing is queued, or only a background job exiting (a SIGCHLD)
+ *    can make room.
+ */
+int admit_timeout(void)
+{
+  if (nqueued == 0 || admit_rate <= 0 || (admit_max > 0 && nbg >= admit_max))
+    return -1;
+  admit_refill();
+  if (admit_tokens >= 1)
+    return 0;
+  return (int)((1 - admit_tokens) / admit_rate * 1000) + 1;
+}
+
+/*
+ * admit_poll - Wait for fd to be readable, starting queued jobs as
+ *    room is made for them. Signals are blocked except in ppoll, so a
+ *    SIGCHLD cannot slip in between admit_run and the wait.
+ */
+void admit_poll(int fd)
+{
+  struct pollfd pfd;
+  struct timespec ts;
+  sigset_t sig, prev, wait_mask;
+  int ms;
+
+  Sigemptyset(&sig);
+  Sigaddset(&sig, SIGCHLD);
+  Sigaddset(&sig, SIGINT);
+  Sigaddset(&sig, SIGTSTP);
+  Sigprocmask(SIG_BLOCK, &sig, &prev);
+  wait_mask = prev;
+  sigdelset(&wait_mask, SIGCHLD);
+  sigdelset(&wait_mask, SIGINT);
+  sigdelset(&wait_mask, SIGTSTP);
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (1) {
+    admit_run();
+    if (nqueued == 0)
+      break;                       /* a plain read can block now */
+    if ((ms = admit_timeout()) >= 0) {
+      ts.tv_sec = ms / 1000;
+      ts.tv_nsec = ms % 1000 * 1000000L;
+    }
+    if (ppoll(&pfd, 1, (ms >= 0) ? &ts : NULL, &wait_mask) > 0)
+      break;
+  }
+  Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/***********************************************
+ * Process placement: CPU affinity and scheduling
+ *
+ * A command word @cpus=LIST in front of a pipeline stage runs that
+ * process on the CPUs in LIST (e.g. 0-3,6). Processes without one are
+ * placed by the shell-wide policy the affinity builtin sets: pin puts
+ * them all on a set of CPUs, spread gives each the next CPU of a set
+ * in turn, and isolate keeps them off a set reserved for something
+ * else. The mask is set in the child before its exec (with -F), or on
+ * the shell around posix_spawn, whose child inherits it; no helper
+ * process such as taskset is run.
+ *
+ * In the same way @nice=N (an increment on the shell's nice value),
+ * @sched=other|batch|idle and @io=CLASS[/LEVEL] (rt, be or idle) set
+ * how a process is scheduled, with the sched builtin's defaults for
+ * what they leave out. With sched -b N a job is also N nice levels
+ * down whenever it is not in the foreground: it starts that way with
+ * &, fg takes the penalty off, and bg or a stop puts it back.
+ **********************************************/
+
+/*
+ * cpulist_parse - Parse a CPU list like 0-3,6 into set. Returns -1 if
+ *    it is malformed, names no CPUs or one past CPU_SETSIZE.
+ */
+int cpulist_parse(const char *s, cpu_set_t *set)
+{
+  long lo, hi;
+  char *end;
+
+  CPU_ZERO(set);
+  do {
+    if (!isdigit((unsigned char)*s))
+      return -1;
+    lo = hi = strtol(s, &end, 10);
+    if (*end == '-') {
+      if (!isdigit((unsigned char)end[1]))
+        return -1;
+      hi = strtol(end + 1, &end, 10);
+    }
+    if (lo > hi || hi >= CPU_SETSIZE)
+      return -1;
+    for (; lo <= hi; lo++)
+      CPU_SET(lo, set);
+    s = end + 1;
+  } while (*end == ',');
+  return (*end == '\0') ? 0 : -1;
+}
+
+/* cpulist_format - Write set to buf as a CPU list, "-" if it is empty */
+char *cpulist_format(const cpu_set_t *set, char *buf, size_t size)
+{
+  size_t n = 0;
+  int lo, hi;
+
+  buf[0] = '\0';
+  for (lo = 0; lo < CPU_SETSIZE && n < size; lo = hi + 1) {
+    if (!CPU_ISSET(lo, set)) {
+      hi = lo;
+      continue;
+    }
+    for (hi = lo; hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set); hi++)
+      ;
+    if (lo == hi)
+      n += snprintf(buf + n, size - n, "%s%d", n ? "," : "", lo);
+    else
+      n += snprintf(buf + n, size - n, "%s%d-%d", n ? "," : "", lo, hi);
+  }
+  if (buf[0] == '\0')
+    snprintf(buf, size, "-");
+  return buf;
+}
+
+/*
+ * policy_parse - The scheduling policy called name (other, batch or
+ *    idle; the real-time ones are not offered), or -1
+ */
+int policy_parse(const char *name)
+{
+  if (strcmp(name, "other") == 0)
+    return SCHED_OTHER;
+  if (strcmp(name, "batch") == 0)
+    return SCHED_BATCH;
+  if (strcmp(name, "idle") == 0)
+    return SCHED_IDLE;
+  return -1;
+}
+
+/* ioprio_parse - The I/O priority CLASS[/LEVEL] stands for, or -1 */
+int ioprio_parse(const char *s)
+{
+  const char *slash = strchr(s, '/');
+  size_t len = (slash == NULL) ? strlen(s) : slash - s;
+  long level = 4;                  /* the kernel's default level */
+  char *end;
+  int c;
+
+  for (c = 1; c < 4; c++)
+    if (strlen(ioclassname[c]) == len && strncmp(s, ioclassname[c], len) == 0)
+      break;
+  if (c == 4)
+    return -1;
+  if (slash != NULL) {
+    level = strtol(slash + 1, &end, 10);
+    if (*end != '\0' || end == slash + 1 || level < 0 || level > 7)
+      return -1;
+  }
+  return IOPRIO_PRIO_VALUE(c, (c == 3) ? 0 : level);
+}
+
+/* ioprio_format - Write I/O priority v to buf as CLASS[/LEVEL] */
+char *ioprio_format(int v, char *buf, size_t size)
+{
+  int c = (v >> IOPRIO_CLASS_SHIFT) & 3;
+
+  if (c == 1 || c == 2)
+    snprintf(buf, size, "%s/%d", ioclassname[c], v & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+  else
+    snprintf(buf, size, "%s", ioclassname[c]);
+  return buf;
+}
+
+/* nice_clamp - The nice value that is shell's plus inc, kept in range */
+static int nice_clamp(int inc)
+{
+  int v = getpriority(PRIO_PROCESS, 0) + inc;
+
+  return (v < -20) ? -20 : (v > 19) ? 19 : v;
+}
+
+/*
+ * place_for - How the process about to run *argvp is placed, taking
+ *    its @cpus=, @nice=, @sched= and @io= prefixes off *argvp. What
+ *    they leave out comes from the affinity policy and the sched
+ *    defaults, and the sched -b penalty is added if it starts in the
+ *    background (bg). Returns 0, or -1 if a prefix is bad (which is
+ *    reported).
  */
-void sigint_handler(int sig) 
+int place_for(char ***argvp, int bg, struct place_t *pl)
 {
-       pid_t fp;        
-       fp=fgpid(jobs);//foreground process pid
-       if(fp>0)
-       {
-            kill(-fp,SIGINT);
-            if(sig<0)
-            {
-              printf("Job [%d] (%d) terminated by signal %d\n",pid2jid(fp),fp,SIGINT);         
-              // signal is negative if it is terminating and thus printing the job that is to be terminated
-              deletejob(jobs,fp); //deleting that job beecause of interupt signal
-            }
-       }
-       return;
+  char **argv = *argvp, *end;
+  const char *bad = NULL;
+  long inc = sched_nice;
+  int i, cpu;
+
+  pl->set = 0;
+  for (; argv[0] != NULL && argv[0][0] == '@' && bad == NULL; argv++) {
+    if (strncmp(argv[0], "@cpus=", 6) == 0) {
+      if (cpulist_parse(argv[0] + 6, &pl->cpus) < 0)
+        bad = "bad CPU list";
+      pl->set |= PL_CPUS;
+    } else if (strncmp(argv[0], "@nice=", 6) == 0) {
+      inc = strtol(argv[0] + 6, &end, 10);
+      if (*end != '\0' || end == argv[0] + 6 || inc < -39 || inc > 39)
+        bad = "bad nice increment";
+      pl->set |= PL_NICE;
+    } else if (strncmp(argv[0], "@sched=", 7) == 0) {
+      if ((pl->policy = policy_parse(argv[0] + 7)) < 0)
+        bad = "no such policy (other, batch or idle)";
+      pl->set |= PL_SCHED;
+    } else if (strncmp(argv[0], "@io=", 4) == 0) {
+      if ((pl->ioprio = ioprio_parse(argv[0] + 4)) < 0)
+        bad = "bad I/O priority";
+      pl->set |= PL_IO;
+    } else
+      break;                       /* an ordinary word that starts with @ */
+  }
+  if (bad != NULL || argv[0] == NULL) {
+    out_printf("%s: %s\n", argv[-1], bad ? bad : "no command");
+    return -1;
+  }
+  *argvp = argv;
+
+  if (!(pl->set & PL_CPUS)) {
+    switch (aff_policy) {
+    case AFF_PIN:
+    case AFF_ISOLATE:
+      pl->cpus = aff_mask;
+      pl->set |= PL_CPUS;
+      break;
+    case AFF_SPREAD:
+      for (i = 0; i < CPU_SETSIZE; i++) {
+        cpu = (aff_next + i) % CPU_SETSIZE;
+        if (CPU_ISSET(cpu, &aff_cpus)) {
+          aff_next = cpu + 1;
+          CPU_ZERO(&pl->cpus);
+          CPU_SET(cpu, &pl->cpus);
+          pl->set |= PL_CPUS;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  if (bg)
+    inc += sched_boost;
+  if (inc != 0 || (pl->set & PL_NICE)) {
+    pl->nice = nice_clamp(inc);
+    pl->set |= PL_NICE;
+  }
+  if (!(pl->set & PL_SCHED) && sched_policy >= 0) {
+    pl->policy = sched_policy;
+    pl->set |= PL_SCHED;
+  }
+  if (!(pl->set & PL_IO) && sched_ioprio >= 0) {
+    pl->ioprio = sched_ioprio;
+    pl->set |= PL_IO;
+  }
+  return 0;
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.  
+ * place_apply - Place process pid (0 for the caller) as pl says.
+ *    Returns -1 with errno set if a step fails.
  */
-void sigtstp_handler(int sig) 
+int place_apply(pid_t pid, const struct place_t *pl)
 {
-  pid_t fp=fgpid(jobs);
-  if(fp>0)
-  {
-    getjobpid(jobs,fp)->state=ST;                                                  
-      // changing the state of the foreground job to stopped
-    printf("Job [%d] (%d) stopped by signal %d\n",pid2jid(fp),fp,SIGTSTP);     
-      // printing the job that is stopped ie temporary killed but can be resumed from where it left
-    kill(-fp,SIGSTOP);        
-      // killing by SIGSTOP signal  (temporary killing)                                                                                  
-  } 
-  return;
+  struct sched_param sp = { 0 };
+
+  if ((pl->set & PL_CPUS) && sched_setaffinity(pid, sizeof(cpu_set_t), &pl->cpus) < 0)
+    return -1;
+  if ((pl->set & PL_SCHED) && sched_setscheduler(pid, pl->policy, &sp) < 0)
+    return -1;
+  if ((pl->set & PL_NICE) && setpriority(PRIO_PROCESS, pid, pl->nice) < 0)
+    return -1;
+  if ((pl->set & PL_IO) && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, pl->ioprio) < 0)
+    return -1;
+  return 0;
 }
 
-/********************
- * End signal handlers
- *********************/
+/*
+ * place_format - Write how live process pid is placed now to buf, for
+ *    jobs -l: its CPUs, nice value, policy and I/O priority
+ */
+char *place_format(pid_t pid, char *buf, size_t size)
+{
+  char cpus[256], io[16];
+  cpu_set_t set;
+  int nice, policy, v;
+
+  if (sched_getaffinity(pid, sizeof(set), &set) < 0) {
+    snprintf(buf, size, "cpus -");  /* the leader has been reaped */
+    return buf;
+  }
+  errno = 0;
+  nice = getpriority(PRIO_PROCESS, pid);
+  policy = sched_getscheduler(pid) & ~SCHED_RESET_ON_FORK;
+  v = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+  snprintf(buf, size, "cpus %s nice %d sched %s io %s", cpulist_format(&set, cpus, sizeof(cpus)), nice,
+           (policy >= 0 && policy <= SCHED_DEADLINE) ? policyname[policy] : "-",
+           (v >= 0) ? ioprio_format(v, io, sizeof(io)) : "-");
+  return buf;
+}
+
+/*
+ * job_place - Place each live process of job as pl says, except that
+ *    pl->nice is an increment on the shell's nice value, to which the
+ *    job's sched -b penalty is added. Returns -1 with errno set if a
+ *    process could not be placed.
+ */
+int job_place(struct job_t *job, const struct place_t *pl)
+{
+  struct place_t p = *pl;
+  pid_t pid;
+  int j, rc = 0;
+
+  if (p.set & PL_NICE)
+    p.nice = nice_clamp(pl->nice + job->penalty);
+  for (j = 0; j < ((job->nprocs < 2) ? 1 : job->nprocs); j++) {
+    if (job->nprocs < 2)
+      pid = job->pid;
+    else if (job->procs[j].status < 0)
+      pid = job->procs[j].pid;
+    else
+      continue;                    /* reaped */
+    if (place_apply(pid, &p) < 0)
+      rc = -1;
+  }
+  return rc;
+}
+
+/*
+ * job_renice - Add inc to the nice value of each live process of job.
+ *    Lowering it may need privilege; where that is missing, the job
+ *    just stays as it is.
+ */
+void job_renice(struct job_t *job, int inc)
+{
+  pid_t pid;
+  int j, v;
+
+  for (j = 0; j < ((job->nprocs < 2) ? 1 : job->nprocs); j++) {
+    if (job->nprocs < 2)
+      pid = job->pid;
+    else if (job->procs[j].status < 0)
+      pid = job->procs[j].pid;
+    else
+      continue;                    /* reaped */
+    errno = 0;
+    v = getpriority(PRIO_PROCESS, pid);
+    if (errno == 0)
+      setpriority(PRIO_PROCESS, pid, v + inc);
+  }
+}
+
+/* sched_demote - Give job, which left the foreground, the sched -b penalty */
+void sched_demote(struct job_t *job)
+{
+  if (job->penalty == 0 && sched_boost > 0) {
+    job_renice(job, sched_boost);
+    job->penalty = sched_boost;
+  }
+}
+
+/* sched_promote - Take the sched -b penalty off job, going to the foreground */
+void sched_promote(struct job_t *job)
+{
+  if (job->penalty > 0) {
+    job_renice(job, -job->penalty);
+    job->penalty = 0;
+  }
+}
 
 /***********************************************
- * Helper routines that manipulate the job list
+ * Command history
+ *
+ * Lines read at the prompt are kept in a ring in a file (HISTFILE, or
+ * ~/.tsh_history) that every tsh maps shared, so each session sees the
+ * others' lines as soon as they are added. After the histhdr_t come
+ * the records: a 32-bit length, the line, and padding to 8 bytes, or
+ * a length of HISTPAD where the ring wraps early. head and tail only
+ * grow and are taken modulo the ring size; the oldest records are
+ * dropped to make room. Adding a line is a memcpy into the mapping
+ * under a non-blocking flock (while another shell holds it, the line
+ * waits for the next one), and the kernel writes the pages back on its
+ * own, nudged by msync(MS_ASYNC) every HISTSYNC lines: a command never
+ * waits for the disk.
+ *
+ * Recall and search use an index the shell builds lazily and then
+ * keeps up to date: the ring offset of each entry, the distinct lines
+ * (each with its latest entry) in a hash table, and an inverted index
+ * from hashed trigrams of "\1\1" + line to the distinct lines that
+ * have them. A query only checks the lines on its rarest trigram's
+ * list, so it stays fast however long the history gets.
  **********************************************/
 
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-  job->pid = 0;
-  job->jid = 0;
-  job->state = UNDEF;
-  job->cmdline[0] = '\0';
+/* hist_hash - FNV-1a hash of the len bytes at s */
+static uint32_t hist_hash(const char *s, size_t len)
+{
+  uint32_t h = 2166136261u;
+
+  while (len-- > 0)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
 }
 
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-  int i;
+/* hist_gram - The index bucket of trigram abc */
+static unsigned int hist_gram(char a, char b, char c)
+{
+  uint32_t g = (unsigned char)a << 16 | (unsigned char)b << 8 | (unsigned char)c;
 
-  for (i = 0; i < MAXJOBS; i++)
-    clearjob(&jobs[i]);
+  return (g * 2654435761u) >> 16 & (HISTGRAMS - 1);
 }
 
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs) 
+/* hist_text - The line of entry seq and its length, or NULL if it is gone or not indexed */
+static const char *hist_text(uint64_t seq, uint32_t *lenp)
 {
-  int i, max=0;
+  const char *rec;
 
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].jid > max)
-      max = jobs[i].jid;
-  return max;
+  if (seq < hist->seqtail || seq < histbase || seq >= histseen)
+    return NULL;
+  rec = histdata + histoff[seq - histbase] % hist->size;
+  memcpy(lenp, rec, sizeof(uint32_t));
+  return rec + sizeof(uint32_t);
 }
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
+/* hist_forget - Drop the index, so it is built again from the oldest entry */
+static void hist_forget(void)
 {
   int i;
-  if (pid < 1)
-    return 0;
 
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == 0) {
-      jobs[i].pid = pid;
-      jobs[i].state = state;
-      jobs[i].jid = nextjid++;
-      if (nextjid > MAXJOBS){
-        nextjid = 1;
+  for (i = 0; i < HISTGRAMS; i++)
+    histgram[i].n = 0;
+  nhlines = 0;
+  if (hltab != NULL)
+    memset(hltab, 0, hltabcap * sizeof(uint32_t));
+  histbase = histseen = hist->seqtail;
+  histpos = hist->tail;
 }
-      strcpy(jobs[i].cmdline, cmdline);
-                           if(verbose){
-        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-      }
-      return 1;
+
+/*
+ * hist_open - Use the history file path, creating it if need be, or
+ *    with path NULL, a ring in memory that lasts as long as the shell.
+ *    Returns -1 (with the history left as it was) if path cannot be
+ *    mapped or holds something other than a tsh history.
+ */
+int hist_open(const char *path)
+{
+  size_t size = HISTHDR + HISTBYTES;
+  struct histhdr_t *h;
+  struct stat st;
+  int fd = -1, fresh = 1;
+
+  if (path != NULL) {
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+      return -1;
+    flock(fd, LOCK_EX);            /* only while a new file gets its header */
+    if (fstat(fd, &st) < 0 || (st.st_size < size && st.st_size > 0) ||
+        (st.st_size == 0 && ftruncate(fd, size) < 0)) {
+      close(fd);                   /* closing drops the lock */
+      return -1;
     }
+    if (st.st_size > 0) {
+      size = st.st_size;
+      fresh = 0;
+    }
+  }
+  h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | (fd < 0 ? MAP_ANONYMOUS : 0), fd, 0);
+  if (h == MAP_FAILED || (!fresh && (memcmp(h->magic, HISTMAGIC, 8) != 0 ||
+                                     h->size == 0 || h->size % 8 != 0 || h->size > size - HISTHDR))) {
+    if (h != MAP_FAILED)
+      munmap(h, size);
+    if (fd >= 0)
+      close(fd);
+    return -1;
   }
-  printf("Tried to create too many jobs\n");
+  if (fresh) {
+    h->size = size - HISTHDR;
+    h->head = h->tail = 0;
+    h->seqhead = h->seqtail = 1;
+    memcpy(h->magic, HISTMAGIC, 8);
+  }
+  if (fd >= 0)
+    flock(fd, LOCK_UN);
+
+  if (hist != NULL) {
+    munmap(hist, HISTHDR + hist->size);
+    if (histfd >= 0)
+      close(histfd);
+  }
+  hist = h;
+  histdata = (char *)h + HISTHDR;
+  histfd = fd;
+  histunsynced = 0;
+  hist_forget();
   return 0;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid) 
+/* hist_init - Open the history on first use: HISTFILE, ~/.tsh_history, or memory */
+void hist_init(void)
 {
-  int i;
-       
-  if (pid < 1)
-    return 0;
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == pid) {
-      clearjob(&jobs[i]);
-      nextjid = maxjid(jobs)+1;
-      return 1;
-    }
+  const char *path = getenv("HISTFILE"), *home = getenv("HOME");
+  char buf[PATH_MAX];
+
+  if (hist != NULL)
+    return;
+  if (path == NULL && home != NULL) {
+    snprintf(buf, sizeof(buf), "%s/.tsh_history", home);
+    path = buf;
   }
+  if (path == NULL || hist_open(path) < 0)
+    hist_open(NULL);
+}
 
-  return 0;
+/*
+ * hist_write - Append the len bytes at line to the ring, dropping the
+ *    oldest records to make room. The file lock must be held. Readers
+ *    in other shells see the record once seqhead covers it.
+ */
+static void hist_write(const char *line, uint32_t len)
+{
+  uint64_t size = hist->size, need = (sizeof(uint32_t) + len + 7) & ~7ULL;
+  uint64_t head = hist->head, tail = hist->tail, seqtail = hist->seqtail, start = head;
+  uint32_t n, pad = HISTPAD;
+  char *rec;
+
+  if (need > size / 2)
+    return;
+  if (head % size + need > size)
+    start += size - head % size;   /* it goes at the start of the ring */
+  while (start + need - tail > size) {
+    memcpy(&n, histdata + tail % size, sizeof(n));
+    if (n == HISTPAD)
+      tail += size - tail % size;
+    else {
+      tail += (sizeof(uint32_t) + n + 7) & ~7ULL;
+      seqtail++;
+    }
+  }
+  __atomic_store_n(&hist->seqtail, seqtail, __ATOMIC_RELEASE);
+  __atomic_store_n(&hist->tail, tail, __ATOMIC_RELEASE);
+  if (start != head)
+    memcpy(histdata + head % size, &pad, sizeof(pad));
+  rec = histdata + start % size;
+  memcpy(rec, &len, sizeof(len));
+  memcpy(rec + sizeof(len), line, len);
+  __atomic_store_n(&hist->head, start + need, __ATOMIC_RELEASE);
+  __atomic_store_n(&hist->seqhead, hist->seqhead + 1, __ATOMIC_RELEASE);
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs) {
+/*
+ * hist_add - Keep line (without its newline) in the history, unless
+ *    it is blank or starts with a space. If another shell is adding a
+ *    line right now, it waits in histpend for the next call instead.
+ */
+void hist_add(const char *line)
+{
+  size_t len = strlen(line);
   int i;
 
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].state == FG)
-      return jobs[i].pid;
-  return 0;
+  if (len > 0 && line[len - 1] == '\n')
+    len--;
+  if (len == 0 || len > HISTMAXLINE || isspace((unsigned char)line[0]))
+    return;
+  hist_init();
+  if (hist == NULL)
+    return;
+  if (histfd >= 0 && flock(histfd, LOCK_EX | LOCK_NB) < 0) {
+    if (nhistpend < HISTPENDMAX && (histpend[nhistpend] = strndup(line, len)) != NULL)
+      nhistpend++;
+    return;
+  }
+  for (i = 0; i < nhistpend; i++) {
+    hist_write(histpend[i], strlen(histpend[i]));
+    free(histpend[i]);
+  }
+  nhistpend = 0;
+  hist_write(line, len);
+  if (histfd >= 0)
+    flock(histfd, LOCK_UN);
+  if (++histunsynced >= HISTSYNC) {
+    msync(hist, HISTHDR + hist->size, MS_ASYNC);
+    histunsynced = 0;
+  }
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-  int i;
+/* hist_index - Add entry seq, the len bytes at text, to the index */
+static void hist_index(uint64_t seq, const char *text, uint32_t len)
+{
+  uint32_t h = hist_hash(text, len), id, tlen, i, j, mask;
+  struct posting_t *p;
+  const char *t;
 
-  if (pid < 1)
-    return NULL;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid)
-      return &jobs[i];
-  return NULL;
+  if (2 * (nhlines + 1) > hltabcap) {
+    hltabcap = (hltabcap == 0) ? 1024 : 2 * hltabcap;
+    free(hltab);
+    if ((hltab = calloc(hltabcap, sizeof(uint32_t))) == NULL)
+      unix_error("calloc error");
+    for (id = 0; id < nhlines; id++) {
+      for (i = hlines[id].hash & (hltabcap - 1); hltab[i] != 0; i = (i + 1) & (hltabcap - 1))
+        ;
+      hltab[i] = id + 1;
+    }
+  }
+  mask = hltabcap - 1;
+  for (i = h & mask; hltab[i] != 0; i = (i + 1) & mask) {
+    id = hltab[i] - 1;
+    if (hlines[id].hash == h && (t = hist_text(hlines[id].seq, &tlen)) != NULL &&
+        tlen == len && memcmp(t, text, len) == 0) {
+      hlines[id].seq = seq;        /* seen before: only its latest entry changes */
+      return;
+    }
+  }
+
+  if (nhlines == hlinescap) {
+    hlinescap = (hlinescap == 0) ? 1024 : 2 * hlinescap;
+    if ((hlines = realloc(hlines, hlinescap * sizeof(struct hline_t))) == NULL)
+      unix_error("realloc error");
+  }
+  id = nhlines++;
+  hlines[id].seq = seq;
+  hlines[id].hash = h;
+  hltab[i] = id + 1;
+  for (j = 0; j < len; j++) {
+    p = &histgram[hist_gram(j >= 2 ? text[j - 2] : 1, j >= 1 ? text[j - 1] : 1, text[j])];
+    if (p->n > 0 && p->ids[p->n - 1] == id)
+      continue;                    /* the line has this trigram already */
+    if (p->n == p->cap) {
+      p->cap = (p->cap == 0) ? 8 : 2 * p->cap;
+      if ((p->ids = realloc(p->ids, p->cap * sizeof(uint32_t))) == NULL)
+        unix_error("realloc error");
+    }
+    p->ids[p->n++] = id;
+  }
 }
 
-/* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid) 
+/*
+ * hist_catchup - Index the entries added since the last call, by this
+ *    shell or any other. The index starts over when entries it holds
+ *    were dropped or cleared, or most of it is for lines long gone.
+ */
+static void hist_catchup(void)
 {
-  int i;
-  if (jid < 1){
-      
-    return NULL;
+  uint64_t seqhead = __atomic_load_n(&hist->seqhead, __ATOMIC_ACQUIRE);
+  uint64_t live = seqhead - __atomic_load_n(&hist->seqtail, __ATOMIC_ACQUIRE);
+  uint32_t n;
+
+  if (seqhead < histseen || histseen < hist->seqtail ||
+      histseen - histbase > 2 * live + 1024 || nhlines > 2 * live + 1024)
+    hist_forget();
+  while (histseen < seqhead) {
+    memcpy(&n, histdata + histpos % hist->size, sizeof(n));
+    if (n == HISTPAD) {
+      histpos += hist->size - histpos % hist->size;
+      continue;
+    }
+    if (n > HISTMAXLINE) {         /* overwritten while we read: start over next time */
+      histseen = histbase = 0;
+      return;
+    }
+    if (histseen - histbase == histoffcap) {
+      histoffcap = (histoffcap == 0) ? 1024 : 2 * histoffcap;
+      if ((histoff = realloc(histoff, histoffcap * sizeof(uint64_t))) == NULL)
+        unix_error("realloc error");
+    }
+    histoff[histseen - histbase] = histpos;
+    hist_index(histseen, histdata + histpos % hist->size + sizeof(n), n);
+    histpos += (sizeof(n) + n + 7) & ~7ULL;
+    histseen++;
+  }
 }
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].jid == jid){
-      
-                       return &jobs[i];
 
-                 }
-        
-  return NULL;
+/*
+ * hist_lookup - The distinct lines that start with (anchored) or
+ *    contain the n bytes at s. Calls found(id) for each, and returns
+ *    the latest entry of any of them, or 0 if there is none. With
+ *    found NULL only that entry matters, so if the index has many
+ *    candidates the newest HISTRECENT entries are tried first: a
+ *    common prefix is nearly always among them.
+ */
+static uint64_t hist_lookup(const char *s, size_t n, int anchored, void (*found)(uint32_t id))
+{
+  struct posting_t *best = NULL, *p;
+  uint64_t latest = 0;
+  const char *t;
+  uint32_t i, id, tlen, count;
+  size_t k;
+
+  for (k = anchored ? 0 : 2; k < n; k++) {   /* the rarest of its trigrams */
+    p = &histgram[hist_gram(k >= 2 ? s[k - 2] : 1, k >= 1 ? s[k - 1] : 1, s[k])];
+    if (best == NULL || p->n < best->n)
+      best = p;
+  }
+  count = (best != NULL) ? best->n : nhlines;  /* no trigram at all: look at every line */
+  if (found == NULL && count > HISTRECENT) {
+    for (i = 1; i <= HISTRECENT && i <= histseen; i++)
+      if ((t = hist_text(histseen - i, &tlen)) != NULL && tlen >= n &&
+          (anchored ? memcmp(t, s, n) == 0 : memmem(t, tlen, s, n) != NULL))
+        return histseen - i;
+  }
+  for (i = 0; i < count; i++) {
+    id = (best != NULL) ? best->ids[i] : i;
+    if ((t = hist_text(hlines[id].seq, &tlen)) == NULL || tlen < n)
+      continue;
+    if (anchored ? memcmp(t, s, n) != 0 : memmem(t, tlen, s, n) == NULL)
+      continue;
+    if (hlines[id].seq > latest)
+      latest = hlines[id].seq;
+    if (found != NULL)
+      found(id);
+  }
+  return latest;
 }
 
-/* pid2jid - Map process ID to job ID */
-int pid2jid(pid_t pid) 
+/*
+ * hist_recall - If the line in *bufp starts with !!, !n, !-n or
+ *    !prefix, replace that word with the line it names (the previous
+ *    one, number n, the nth last, or the latest starting with prefix),
+ *    in *bufp, grown like read_cmdline does, and echo the result.
+ *    Returns -1 if there is no such line (which is reported).
+ */
+int hist_recall(char **bufp, size_t *capp)
 {
-  int i;
+  char *line = *bufp, *end, *num;
+  size_t word, rest;
+  uint64_t seq = 0, seqhead;
+  const char *text = NULL;
+  uint32_t len;
 
-  if (pid < 1)
+  if (line[0] != '!' || line[1] == '\0' || isspace((unsigned char)line[1]))
     return 0;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid) {
-      return jobs[i].jid;
+  for (word = 1; line[word] != '\0' && !isspace((unsigned char)line[word]); word++)
+    ;
+  hist_init();
+  if (hist != NULL) {
+    hist_catchup();
+    seqhead = hist->seqhead;
+    num = line + 1 + (line[1] == '-');
+    if (isdigit((unsigned char)*num)) {
+      seq = strtoull(num, &end, 10);
+      if (end != line + word)
+        seq = 0;
+      else if (line[1] == '-')
+        seq = (seq < seqhead) ? seqhead - seq : 0;
     }
+    else if (word == 2 && line[1] == '!')
+      seq = seqhead - 1;
+    else
+      seq = hist_lookup(line + 1, word - 1, 1, NULL);
+    text = hist_text(seq, &len);
+  }
+  if (text == NULL) {
+    out_printf("%.*s: event not found\n", (int)word, line);
+    return -1;
+  }
+
+  rest = strlen(line + word) + 1;
+  if (*capp < len + rest) {
+    *capp = len + rest;
+    if ((*bufp = line = realloc(line, *capp)) == NULL)
+      unix_error("realloc error");
+  }
+  memmove(line + len, line + word, rest);
+  memcpy(line, text, len);
+  out_printf("%s", line);
   return 0;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs) 
+/* hist_clear - Empty the history and number lines from 1 again */
+void hist_clear(void)
 {
-  int i;
+  if (histfd >= 0)
+    flock(histfd, LOCK_EX);
+  __atomic_store_n(&hist->seqhead, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&hist->seqtail, 1, __ATOMIC_RELEASE);
+  hist->head = hist->tail = 0;
+  if (histfd >= 0)
+    flock(histfd, LOCK_UN);
+  hist_forget();
+}
 
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid != 0) {
-      printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-      switch (jobs[i].state) {
-        case BG: 
-          printf("Running ");
-          break;
-        case FG: 
-          printf("Foreground ");
-          break;
-        case ST: 
-          printf("Stopped ");
-          break;
-        default:
-          printf("listjobs: Internal error: job[%d].state=%d ", 
-              i, jobs[i].state);
-      }
-      printf("%s", jobs[i].cmdline);
+/* hist_list - Print the last n lines of the history with their numbers */
+void hist_list(uint64_t n)
+{
+  uint64_t seq;
+  const char *t;
+  uint32_t len;
+
+  hist_catchup();
+  seq = (histseen - hist->seqtail > n) ? histseen - n : hist->seqtail;
+  for (; seq < histseen; seq++)
+    if ((t = hist_text(seq, &len)) != NULL)
+      out_printf("%5" PRIu64 "  %.*s\n", seq, (int)len, t);
+}
+
+static uint32_t *histfound = NULL;  /* lines hist_search found */
+static uint32_t nhistfound = 0, histfoundcap = 0;
+
+/* hist_found - Note distinct line id for hist_search */
+static void hist_found(uint32_t id)
+{
+  if (nhistfound == histfoundcap) {
+    histfoundcap = (histfoundcap == 0) ? 64 : 2 * histfoundcap;
+    if ((histfound = realloc(histfound, histfoundcap * sizeof(uint32_t))) == NULL)
+      unix_error("realloc error");
+  }
+  histfound[nhistfound++] = id;
+}
+
+/* hist_cmp - qsort order of found lines: by their latest entry */
+static int hist_cmp(const void *a, const void *b)
+{
+  uint64_t x = hlines[*(const uint32_t *)a].seq, y = hlines[*(const uint32_t *)b].seq;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * hist_search - Print the distinct lines containing s, each with the
+ *    number of its latest entry, oldest first. Returns 1 if there are
+ *    none.
+ */
+int hist_search(const char *s)
+{
+  const char *t;
+  uint32_t i, len;
+
+  hist_catchup();
+  nhistfound = 0;
+  hist_lookup(s, strlen(s), 0, hist_found);
+  qsort(histfound, nhistfound, sizeof(uint32_t), hist_cmp);
+  for (i = 0; i < nhistfound; i++) {
+    t = hist_text(hlines[histfound[i]].seq, &len);
+    out_printf("%5" PRIu64 "  %.*s\n", hlines[histfound[i]].seq, (int)len, t);
+  }
+  return nhistfound == 0;
+}
+
+/***********************************************
+ * Zygote (-z)
+ *
+ * Forking costs more the bigger the shell gets: its page tables are
+ * copied, and with fork+execve each page it then writes faults. With
+ * -z, main forks a zygote before anything else is allocated, and
+ * spawn_job has it start programs instead. Over a SOCK_SEQPACKET
+ * socketpair it sends a zreq_t with the path, argv and redirections,
+ * and the pipe ends and the hashed executable as SCM_RIGHTS
+ * descriptors. The zygote forks with CLONE_PARENT, so the program is
+ * the shell's child as in the other paths: the shell gets its
+ * SIGCHLD, reaps it, and may setpgid and signal it. The zygote
+ * replies with the pid. It dies with the shell, and if it is gone
+ * spawn_job goes back to starting programs itself.
+ **********************************************/
+
+/*
+ * zygote_exec - In a child of the zygote, set up and exec the program
+ *    req asks for, with the nfds descriptors that came with it
+ */
+static void zygote_exec(struct zreq_t *req, int *fds, int nfds)
+{
+  struct redir_t *redir;
+  int *ri = (int *)(req + 1), i, k = 0, in = -1, out = -1, exe = -1;
+  char **argv, *path, *p;
+
+  signal(SIGINT, SIG_DFL);         /* ignored ones would stay ignored after exec */
+  signal(SIGTSTP, SIG_DFL);
+  setpgid(0, req->pgid);
+  if ((req->fds & ZFD_IN) && k < nfds)
+    in = fds[k++];
+  if ((req->fds & ZFD_OUT) && k < nfds)
+    out = fds[k++];
+  if ((req->fds & ZFD_EXE) && k < nfds)
+    exe = fds[k++];
+  if ((argv = malloc((req->nargv + 1) * sizeof(char *))) == NULL ||
+      (redir = malloc((req->nredir + 1) * sizeof(struct redir_t))) == NULL)
+    _exit(1);
+  p = (char *)(ri + 2 * req->nredir);
+  path = p;
+  p += strlen(p) + 1;
+  for (i = 0; i < req->nargv; i++, p += strlen(p) + 1)
+    argv[i] = p;
+  argv[i] = NULL;
+  for (i = 0; i < req->nredir; i++, p += strlen(p) + 1) {
+    redir[i].type = ri[2 * i];
+    redir[i].fd = ri[2 * i + 1];
+    redir[i].target = p;
+  }
+
+  if (place_apply(0, &req->pl) < 0) {
+    out_printf("%s: %s\n", argv[0], strerror(errno));
+    out_flush();                   /* the zygote has no atexit handler */
+    _exit(1);
+  }
+  if (in >= 0)
+    dup2(in, STDIN_FILENO);        /* the copies lose close-on-exec, the received ones keep it */
+  if (out >= 0)
+    dup2(out, STDOUT_FILENO);
+  if (redirect(redir, req->nredir, NULL) < 0) {
+    out_flush();
+    _exit(1);
+  }
+  if (exe >= 0)
+    fexecve(exe, argv, environ);
+  execve(path, argv, environ);
+  out_printf("%s: Command not found\n", argv[0]);
+  out_flush();
+  _exit(1);
+}
+
+/* zygote_serve - The zygote's loop: start a program for each request */
+static void zygote_serve(int sock)
+{
+  static union { struct zreq_t req; char b[ZYGOTEBUF]; } buf;
+  union { struct cmsghdr h; char b[CMSG_SPACE(3 * sizeof(int))]; } cm;
+  struct cmsghdr *c;
+  struct msghdr msg;
+  struct iovec iov;
+  int fds[3], nfds, i;
+  long reply;
+  ssize_t n;
+
+  while (1) {
+    iov.iov_base = buf.b;
+    iov.iov_len = sizeof(buf);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cm.b;
+    msg.msg_controllen = sizeof(cm.b);
+    if ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      _exit(0);                    /* the shell is gone */
+    nfds = 0;
+    if ((c = CMSG_FIRSTHDR(&msg)) != NULL && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
     }
+    /* like fork, but the child's parent (and SIGCHLD) is the shell */
+    if ((reply = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL)) == 0)
+      zygote_exec(&buf.req, fds, nfds);
+    if (reply < 0)
+      reply = -errno;
+    for (i = 0; i < nfds; i++)
+      close(fds[i]);               /* or a pipe would never see end of file */
+    send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
   }
 }
-/******************************
- * end job list helper routines
- ******************************/
 
+/* zygote_start - Fork the zygote, leaving zygote_fd connected to it */
+void zygote_start(void)
+{
+  pid_t shell = getpid(), pid;
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    unix_error("socketpair error");
+  if ((pid = fork()) < 0)
+    unix_error("fork error");
+  if (pid == 0) {
+    close(sv[0]);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != shell)        /* it died before the prctl */
+      _exit(0);
+    signal(SIGINT, SIG_IGN);       /* ctrl-c and ctrl-z at the terminal are not for it */
+    signal(SIGTSTP, SIG_IGN);
+    zygote_serve(sv[1]);
+  }
+  close(sv[1]);
+  zygote_fd = sv[0];
+}
+
+/* zput - Append string s at *np in buf, if it fits in ZYGOTEBUF */
+static int zput(char *buf, size_t *np, const char *s)
+{
+  size_t len = strlen(s) + 1;
+
+  if (*np + len > ZYGOTEBUF)
+    return -1;
+  memcpy(buf + *np, s, len);
+  *np += len;
+  return 0;
+}
+
+/*
+ * zygote_spawn - Have the zygote start path as spawn_job would (with
+ *    exefd, unless -1, as the file to fexecve). Returns the pid, 0 if
+ *    it could not be started (which is reported), or -1 if the zygote
+ *    cannot take it: the request is too big, or the zygote is gone.
+ */
+pid_t zygote_spawn(const char *path, int exefd, char **argv, pid_t pgid, int in, int out,
+                   struct redir_t *redir, int nredir, const struct place_t *pl)
+{
+  static union { struct zreq_t req; char b[ZYGOTEBUF]; } buf;
+  union { struct cmsghdr h; char b[CMSG_SPACE(3 * sizeof(int))]; } cm;
+  int *ri = (int *)(&buf.req + 1), fds[3], nfds = 0, i;
+  size_t n = sizeof(buf.req) + 2 * nredir * sizeof(int);
+  struct cmsghdr *c;
+  struct msghdr msg;
+  struct iovec iov;
+  long reply;
+  ssize_t r;
+
+  if (n > ZYGOTEBUF || zput(buf.b, &n, path) < 0)
+    return -1;
+  for (i = 0; argv[i] != NULL; i++)
+    if (zput(buf.b, &n, argv[i]) < 0)
+      return -1;
+  buf.req.nargv = i;
+  for (i = 0; i < nredir; i++) {
+    ri[2 * i] = redir[i].type;
+    ri[2 * i + 1] = redir[i].fd;
+    if (zput(buf.b, &n, redir[i].target) < 0)
+      return -1;
+  }
+  buf.req.nredir = nredir;
+  buf.req.pgid = pgid;
+  buf.req.pl = *pl;
+  buf.req.fds = 0;
+  if (in >= 0) {
+    buf.req.fds |= ZFD_IN;
+    fds[nfds++] = in;
+  }
+  if (out >= 0) {
+    buf.req.fds |= ZFD_OUT;
+    fds[nfds++] = out;
+  }
+  if (exefd >= 0) {
+    buf.req.fds |= ZFD_EXE;
+    fds[nfds++] = exefd;
+  }
+
+  iov.iov_base = buf.b;
+  iov.iov_len = n;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (nfds > 0) {
+    msg.msg_control = cm.b;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(c), fds, nfds * sizeof(int));
+  }
+  while ((r = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    ;
+  if (r > 0)
+    while ((r = recv(zygote_fd, &reply, sizeof(reply), 0)) < 0 && errno == EINTR)
+      ;
+  if (r <= 0) {
+    close(zygote_fd);              /* it is gone: from now on, spawn_job forks */
+    zygote_fd = -1;
+    return -1;
+  }
+  if (reply < 0) {
+    out_printf("%s: %s\n", argv[0], strerror(-reply));
+    return 0;
+  }
+  return reply;
+}
 
 /***********************
  * Other helper routines
@@ -677,10 +6168,14 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void) 
 {
-  printf("Usage: shell [-hvp]\n");
-  printf("   -h   print this message\n");
-  printf("   -v   print additional diagnostic information\n");
-  printf("   -p   do not emit a command prompt\n");
+  out_printf("Usage: shell [-hvpeFz] [-f script]\n");
+  out_printf("   -h   print this message\n");
+  out_printf("   -v   print additional diagnostic information\n");
+  out_printf("   -p   do not emit a command prompt\n");
+  out_printf("   -e   handle signals and input in a signalfd/epoll event loop\n");
+  out_printf("   -F   start jobs with fork+execve instead of posix_spawn\n");
+  out_printf("   -z   start jobs through a pre-forked zygote process\n");
+  out_printf("   -f   run the commands in script, then exit\n");
   exit(1);
 }
 
@@ -689,7 +6184,7 @@ void usage(void)
  */
 void unix_error(char *msg)
 {
-  fprintf(stdout, "%s: %s\n", msg, strerror(errno));
+  out_printf("%s: %s\n", msg, strerror(errno));
   exit(1);
 }
 
@@ -698,7 +6193,7 @@ void unix_error(char *msg)
  */
 void app_error(char *msg)
 {
-  fprintf(stdout, "%s\n", msg);
+  out_printf("%s\n", msg);
   exit(1);
 }
 
@@ -723,14 +6218,18 @@ handler_t *Signal(int signum, handler_t *handler)
  */
 void sigquit_handler(int sig) 
 {
-  printf("Terminating after receipt of SIGQUIT signal\n");
-  exit(1);
+  static char msg[] = "Terminating after receipt of SIGQUIT signal\n";
+
+  if (!out_busy)
+    out_flush();
+  write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+  _exit(1);  /* exit() would run out_flush from a handler */
 }
 
 int Sigprocmask(int action, sigset_t* Sigset, void* t){
     int stat;                                                                            
 
-    if((stat = sigprocmask(action, Sigset, NULL))){                                      // implementing safe sigprocmask()   
+    if((stat = sigprocmask(action, Sigset, t))){                                         // implementing safe sigprocmask()   
         unix_error("Fatal: Sigprocmask Error!");                                           
     }
 
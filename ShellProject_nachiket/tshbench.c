@@ -0,0 +1,404 @@
+/*
+ * tshbench.c - Measures a shell from the outside, the way sdriver.pl
+ * drives it, and prints the results as JSON.
+ *
+ * usage: tshbench [n] [shell...]
+ * Each shell (default ./tsh and ./tshref) is started with -p, its
+ * stdin and stdout (with stderr) on pipes, and signals are sent to it
+ * as sdriver.pl sends them. For each shell it reports:
+ *   fg_per_sec    <n> "./myspin 0" foreground commands run per second
+ *   bg_per_sec    <n> "./myspin 0 &" background jobs started per second
+ *                 (bg_failed: how many the shell refused)
+ *   sigint_us     SIGINT sent to the shell -> "terminated by signal" read
+ *   sigtstp_us    SIGTSTP sent to the shell -> "stopped by signal" read
+ *   jobs_us       "jobs" written -> its last line read, with 1 to 256
+ *                 background jobs, as many as the shell takes
+ * Rates are the median of RUNS runs and latencies the 50th and 99th
+ * percentiles of TRIALS trials, in microseconds, so that numbers from
+ * one run to the next can be compared.
+ *
+ */
+#define _GNU_SOURCE          /* pipe2 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define RUNS       5   /* runs of each rate measurement */
+#define TRIALS    50   /* trials of each latency measurement */
+#define TIMEOUT 5000   /* ms to wait for an expected line */
+#define MAXKIDS  512   /* children of the shell looked at */
+
+struct shell {
+    pid_t pid;
+    int in;                 /* the shell's stdin */
+    int out;                /* the shell's stdout and stderr */
+    char buf[65536];        /* output read but not yet looked at */
+    size_t len;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* start - Run path -p with its stdin and stdout on pipes */
+static int start(struct shell *sh, const char *path)
+{
+    int in[2], out[2];
+
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    if ((sh->pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (sh->pid == 0) {
+	dup2(in[0], STDIN_FILENO);
+	dup2(out[1], STDOUT_FILENO);
+	dup2(out[1], STDERR_FILENO);
+	execl(path, path, "-p", (char *)NULL);
+	_exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    sh->in = in[1];
+    sh->out = out[0];
+    sh->len = 0;
+    return 0;
+}
+
+/* put - Write s to the shell's stdin */
+static void put(struct shell *sh, const char *s)
+{
+    size_t len = strlen(s);
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write(sh->in, s, len)) < 0) {
+	    perror("write");
+	    exit(1);
+	}
+	s += n;
+	len -= n;
+    }
+}
+
+/*
+ * expect - Read the shell's output up to a line containing one of the
+ *    n strings in pats, dropping the lines before it. Returns the index
+ *    of the string found, or -1 on a timeout or end of file.
+ */
+static int expect(struct shell *sh, const char **pats, int n)
+{
+    struct pollfd pfd = { sh->out, POLLIN, 0 };
+    char *line, *nl;
+    ssize_t got;
+    int i;
+
+    while (1) {
+	for (line = sh->buf; (nl = memchr(line, '\n', sh->buf + sh->len - line)) != NULL;
+	     line = nl + 1) {
+	    *nl = '\0';
+	    for (i = 0; i < n; i++)
+		if (strstr(line, pats[i]) != NULL)
+		    break;
+	    if (i < n) {
+		line = nl + 1;
+		break;
+	    }
+	}
+	sh->len -= line - sh->buf;
+	memmove(sh->buf, line, sh->len);
+	if (nl != NULL)
+	    return i;
+	if (sh->len == sizeof(sh->buf))
+	    sh->len = 0;    /* one enormous line: not one we are waiting for */
+	if (poll(&pfd, 1, TIMEOUT) <= 0)
+	    return -1;
+	if ((got = read(sh->out, sh->buf + sh->len, sizeof(sh->buf) - sh->len)) <= 0)
+	    return -1;
+	sh->len += got;
+    }
+}
+
+/* finish - Close the shell's stdin, read its output to the end and reap it */
+static void finish(struct shell *sh)
+{
+    char buf[4096];
+
+    close(sh->in);
+    while (read(sh->out, buf, sizeof(buf)) > 0)
+	;
+    close(sh->out);
+    waitpid(sh->pid, NULL, 0);
+}
+
+/* children - Read the pids of the shell's children into kids */
+static int children(struct shell *sh, pid_t *kids)
+{
+    char path[64];
+    FILE *fp;
+    int n = 0;
+
+    sprintf(path, "/proc/%d/task/%d/children", sh->pid, sh->pid);
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    while (n < MAXKIDS && fscanf(fp, "%d", &kids[n]) == 1)
+	n++;
+    fclose(fp);
+    return n;
+}
+
+/* running - Wait until the shell has a child that has become myspin; returns its pid */
+static pid_t running(struct shell *sh)
+{
+    pid_t kids[MAXKIDS];
+    char path[64], comm[64];
+    double until = now() + TIMEOUT / 1000.0;
+    FILE *fp;
+    int i, n;
+
+    while (now() < until) {
+	n = children(sh, kids);
+	for (i = 0; i < n; i++) {
+	    sprintf(path, "/proc/%d/comm", kids[i]);
+	    if ((fp = fopen(path, "r")) == NULL)
+		continue;
+	    if (fgets(comm, sizeof(comm), fp) != NULL && strcmp(comm, "myspin\n") == 0) {
+		fclose(fp);
+		return kids[i];
+	    }
+	    fclose(fp);
+	}
+	usleep(100);
+    }
+    return -1;
+}
+
+/* stop - Kill the shell and every job it still has */
+static void stop(struct shell *sh)
+{
+    pid_t kids[MAXKIDS];
+    int i, n = children(sh, kids);
+
+    for (i = 0; i < n; i++)
+	kill(kids[i], SIGKILL);
+    kill(sh->pid, SIGKILL);
+    finish(sh);
+}
+
+/*
+ * rate - Feed the shell n copies of line, then end of file, and return
+ *    the lines handled per second, the median of RUNS runs. *failed is
+ *    set to the lines of the last run the shell refused.
+ */
+static double rate(const char *path, const char *line, int n, int *failed)
+{
+    static const char *pats[] = { "too many jobs" };
+    struct shell sh;
+    double t, r[RUNS];
+    char *script;
+    size_t len = strlen(line);
+    int i, k;
+
+    if ((script = malloc(n * len + 1)) == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    for (i = 0; i < n; i++)
+	memcpy(script + i * len, line, len);
+    script[n * len] = '\0';
+
+    fflush(stdout);             /* or the writer would copy it */
+    for (k = 0; k < RUNS; k++) {
+	start(&sh, path);
+	t = now();
+	if (fork() == 0) {      /* a writer, so the shell's output can be read meanwhile */
+	    close(sh.out);
+	    put(&sh, script);
+	    _exit(0);
+	}
+	close(sh.in);
+	sh.in = -1;
+	for (*failed = 0; expect(&sh, pats, 1) == 0; (*failed)++)
+	    ;
+	waitpid(sh.pid, NULL, 0);
+	r[k] = n / (now() - t);
+	wait(NULL);
+	close(sh.out);
+    }
+    free(script);
+    qsort(r, RUNS, sizeof(double), cmp_double);
+    return r[RUNS / 2];
+}
+
+/* runs - True if the shell starts and exits 0 at end of file */
+static int runs(const char *path)
+{
+    struct shell sh;
+    int status;
+
+    fflush(stdout);
+    start(&sh, path);
+    close(sh.in);
+    close(sh.out);
+    return waitpid(sh.pid, &status, 0) > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* print_lat - Print "name": {"p50": .., "p99": ..} for the n latencies in lat */
+static void print_lat(const char *name, double *lat, int n)
+{
+    if (n == 0) {
+	printf("      \"%s\": null", name);
+	return;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("      \"%s\": {\"p50\": %.1f, \"p99\": %.1f}", name, lat[n / 2], lat[n * 99 / 100]);
+}
+
+/*
+ * signals - Time TRIALS ctrl-c's and ctrl-z's of a foreground job,
+ *    from the signal being sent to the shell to its report being read.
+ */
+static void signals(const char *path)
+{
+    static const char *term[] = { "terminated by signal" };
+    static const char *stopped[] = { "stopped by signal" };
+    static const char *killed[] = { "signal 9" };
+    double lint[TRIALS], ltstp[TRIALS], t;
+    struct shell sh;
+    int i, nint = 0, ntstp = 0;
+    pid_t job;
+
+    start(&sh, path);
+    for (i = 0; i < TRIALS; i++) {
+	put(&sh, "./myspin 10\n");
+	if ((job = running(&sh)) < 0)
+	    break;
+	t = now();
+	kill(sh.pid, SIGINT);
+	if (expect(&sh, term, 1) < 0)
+	    break;
+	lint[nint++] = (now() - t) * 1e6;
+    }
+    for (i = 0; i < TRIALS && nint == TRIALS; i++) {
+	put(&sh, "./myspin 10\n");
+	if ((job = running(&sh)) < 0)
+	    break;
+	t = now();
+	kill(sh.pid, SIGTSTP);
+	if (expect(&sh, stopped, 1) < 0)
+	    break;
+	ltstp[ntstp++] = (now() - t) * 1e6;
+	kill(job, SIGKILL);     /* the stopped job would fill the job table */
+	if (expect(&sh, killed, 1) < 0)
+	    break;
+    }
+    stop(&sh);
+    print_lat("sigint_us", lint, nint);
+    printf(",\n");
+    print_lat("sigtstp_us", ltstp, ntstp);
+}
+
+/*
+ * jobs - Time the jobs builtin with more and more background jobs,
+ *    up to the most the shell takes.
+ */
+static void jobs(const char *path)
+{
+    static const int sizes[] = { 1, 8, 15, 64, 256 };
+    static const char *started[] = { "] (", "too many jobs" };
+    static const char *listed[] = { "] (" };
+    double lat[TRIALS], t;
+    struct shell sh;
+    int i, k, n = 0, lines, first = 1;
+
+    start(&sh, path);
+    printf("      \"jobs_us\": [");
+    for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+	for (; n < sizes[k]; n++) {
+	    put(&sh, "./myspin 60 &\n");
+	    if (expect(&sh, started, 2) != 0)
+		break;
+	}
+	if (n < sizes[k])
+	    break;
+	for (i = 0; i < TRIALS; i++) {
+	    t = now();
+	    put(&sh, "jobs\n");
+	    for (lines = 0; lines < n && expect(&sh, listed, 1) == 0; lines++)
+		;
+	    if (lines < n)
+		break;
+	    lat[i] = (now() - t) * 1e6;
+	}
+	if (i < TRIALS)
+	    break;
+	qsort(lat, TRIALS, sizeof(double), cmp_double);
+	printf("%s\n        {\"jobs\": %d, \"p50\": %.1f, \"p99\": %.1f}", first ? "" : ",",
+	       n, lat[TRIALS / 2], lat[TRIALS * 99 / 100]);
+	first = 0;
+    }
+    printf("\n      ]");
+    stop(&sh);
+}
+
+int main(int argc, char **argv)
+{
+    static char *defaults[] = { "./tsh", "./tshref" };
+    char **shells = defaults;
+    int i, n = 500, nshells = 2, failed;
+
+    if (argc > 1)
+	n = atoi(argv[1]);
+    if (argc > 2) {
+	shells = argv + 2;
+	nshells = argc - 2;
+    }
+    if (n <= 0) {
+	fprintf(stderr, "Usage: %s [n] [shell...]\n", argv[0]);
+	exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("{\n  \"n\": %d,\n  \"shells\": [", n);
+    for (i = 0; i < nshells; i++) {
+	printf("%s\n    {\n      \"shell\": \"%s\",\n", i > 0 ? "," : "", shells[i]);
+	if (access(shells[i], X_OK) < 0 || !runs(shells[i])) {
+	    printf("      \"error\": \"%s\"\n    }",
+		   access(shells[i], X_OK) < 0 ? strerror(errno) : "does not run");
+	    continue;
+	}
+	printf("      \"fg_per_sec\": %.1f,\n", rate(shells[i], "./myspin 0\n", n, &failed));
+	printf("      \"bg_per_sec\": %.1f,\n", rate(shells[i], "./myspin 0 &\n", n, &failed));
+	printf("      \"bg_failed\": %d,\n", failed);
+	fflush(stdout);
+	signals(shells[i]);
+	printf(",\n");
+	jobs(shells[i]);
+	printf("\n    }");
+	fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+    exit(0);
+}
@@ -0,0 +1,113 @@
+/*
+ * zygotebench.c - Measures the latency of starting a job through each
+ * of the tsh spawn paths as the shell's memory footprint grows.
+ *
+ * usage: zygotebench [n] [cmdline]
+ * Links against tsh.c (with its main renamed) and starts its zygote
+ * first, while the process is small, as tsh -z does. Then for each
+ * resident size it dirties that many MiB of heap and runs <cmdline>
+ * (default "./myspin 0") <n> times through eval() as a foreground job
+ * with fork+execve (-F), posix_spawn (the default) and the zygote
+ * (-z), printing the 50th and 99th percentile time per command in
+ * microseconds, from eval() being called to the job being reaped.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+struct job_t;
+extern struct job_t *jobs;
+extern int use_fork;
+extern int zygote_fd;
+void initjobs(struct job_t *jobs);
+void eval(char *cmdline);
+void zygote_start(void);
+void sigchld_handler(int sig);
+typedef void handler_t(int);
+handler_t *Signal(int signum, handler_t *handler);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* run - Time n evals of cmdline, and print their p50 and p99 in us */
+static void run(int n, const char *cmdline, double *lat)
+{
+    char buf[1024];
+    double t;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	strcpy(buf, cmdline);      /* eval may parse it in place */
+	t = now();
+	eval(buf);
+	lat[i] = (now() - t) * 1e6;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf(" %10.0f %10.0f", lat[n / 2], lat[n * 99 / 100]);
+}
+
+int main(int argc, char **argv)
+{
+    static const int sizes[] = { 0, 64, 256, 1024 };  /* MiB */
+    char cmdline[1024] = "./myspin 0\n";
+    char *heap = NULL;
+    size_t have = 0, want;
+    double *lat;
+    int i, n = 500, zfd;
+
+    if (argc > 1)
+	n = atoi(argv[1]);
+    if (argc > 2)
+	snprintf(cmdline, sizeof(cmdline), "%s\n", argv[2]);
+    if (n <= 0 || (lat = malloc(n * sizeof(double))) == NULL) {
+	fprintf(stderr, "Usage: %s [n] [cmdline]\n", argv[0]);
+	exit(1);
+    }
+
+    zygote_start();
+    zfd = zygote_fd;
+    Signal(SIGCHLD, sigchld_handler);
+    initjobs(jobs);
+
+    printf("%8s %10s %10s %10s %10s %10s %10s\n", "RSS MiB",
+	   "fork p50", "fork p99", "spawn p50", "spawn p99", "zygote p50", "zygote p99");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+	want = (size_t)sizes[i] << 20;
+	if (want > have) {
+	    if ((heap = realloc(heap, want)) == NULL) {
+		perror("realloc");
+		exit(1);
+	    }
+	    memset(heap + have, 1, want - have);  /* make it resident */
+	    have = want;
+	}
+	printf("%8d", sizes[i]);
+	use_fork = 1;
+	zygote_fd = -1;
+	run(n, cmdline, lat);
+	use_fork = 0;
+	run(n, cmdline, lat);
+	zygote_fd = zfd;
+	run(n, cmdline, lat);
+	printf("\n");
+	fflush(stdout);
+    }
+    free(heap);
+    free(lat);
+    exit(0);
+}